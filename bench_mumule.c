@@ -0,0 +1,389 @@
+/*
+ * bench_mumule - dispatch overhead, fork-join latency and scaling
+ *
+ * usage: bench_mumule [-t threads] [-n items] [-r reps] [-w warmup] [-a]
+ *                     [-j out.json] [-c out.csv]
+ *                     [--compare baseline.json] [--threshold percent]
+ *
+ * - item: ns per item of an empty kernel, for each thread count
+ * - roundtrip: ns from mule_submit to mule_sync returning, for batches of
+ *   1 to `items` in powers of ten, on the largest thread count
+ * - startstop: ns for a mule_start and mule_stop pair
+ * - throughput: items per second of a ~1us kernel, for each thread count
+ *
+ * each measurement runs `warmup` times unrecorded then `reps` times, and
+ * reports the median with a distribution-free 95% confidence interval
+ * from the order statistics, and the min and max. `-a` pins workers to
+ * cpus in order. thread counts default to powers of two up to the number
+ * of online cpus.
+ *
+ * `--compare` reads a JSON file written by an earlier run with `-j` and
+ * reports the change of each metric's median against it, with an interval
+ * from the two confidence intervals. it exits with status 2 if a metric got
+ * worse by more than `--threshold` percent (default 5) and the interval
+ * excludes no change. more reps give tighter intervals.
+ */
+
+#undef NDEBUG
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <math.h>
+#include "mumule.h"
+
+int debug = 0;
+
+typedef struct {
+	const char *name;
+	const char *unit;
+	size_t threads;
+	size_t batch;
+	double median, min, max;
+	double ci_lo, ci_hi;
+	size_t reps;
+	double *samples;
+} result;
+
+typedef struct {
+	size_t reps, warmup;
+	int affinity;
+	result *results;
+	size_t num_results, max_results;
+} bench;
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void empty_kernel(void *arg, size_t thr_idx, size_t item_idx) {}
+
+static void spin_kernel(void *arg, size_t thr_idx, size_t item_idx)
+{
+	uint64_t t0 = now_ns();
+	while (now_ns() - t0 < 1000);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+/*
+ * ranks bounding a 95% confidence interval for the median of n sorted
+ * samples, from the normal approximation to the binomial. with fewer than
+ * eight samples the interval is the full range.
+ */
+static void median_ci(size_t n, size_t *lo, size_t *hi)
+{
+	double d = 0.98 * sqrt((double)n);
+	long l = (long)floor(n / 2.0 - d), h = (long)ceil(n / 2.0 + d);
+	*lo = l < 0 ? 0 : (size_t)l;
+	*hi = h > (long)n - 1 ? n - 1 : (size_t)h;
+}
+
+static void record(bench *b, const char *name, const char *unit, size_t threads,
+	size_t batch, double *samples)
+{
+	if (b->num_results == b->max_results) {
+		b->max_results = b->max_results ? b->max_results * 2 : 64;
+		assert((b->results = realloc(b->results, b->max_results * sizeof(result))));
+	}
+	qsort(samples, b->reps, sizeof(double), cmp_double);
+	size_t n = b->reps, lo, hi;
+	double median = n & 1 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+	median_ci(n, &lo, &hi);
+	result r = { name, unit, threads, batch, median, samples[0], samples[n - 1],
+		samples[lo], samples[hi], n, malloc(n * sizeof(double)) };
+	assert(r.samples);
+	memcpy(r.samples, samples, n * sizeof(double));
+	b->results[b->num_results++] = r;
+	printf("%-10s %7zu %8zu %14.1f %14.1f %14.1f %14.1f %14.1f %s\n", name, threads,
+		batch, median, r.ci_lo, r.ci_hi, samples[0], samples[n - 1], unit);
+	fflush(stdout);
+}
+
+static void pool_init(bench *b, mu_mule *mule, size_t threads, mumule_work_fn kernel)
+{
+	mu_thread_attr attr = { 0 };
+	mule_init(mule, threads, kernel, NULL);
+	attr.affinity = b->affinity ? mumule_affinity_compact : mumule_affinity_none;
+	mule_thread_attr(mule, &attr);
+}
+
+/* time `count` items from submit to sync, in ns */
+static double run_batch(mu_mule *mule, size_t count)
+{
+	uint64_t t0 = now_ns();
+	mule_submit(mule, count);
+	mule_sync(mule);
+	return (double)(now_ns() - t0);
+}
+
+static void bench_item(bench *b, size_t threads, size_t items, double *samples)
+{
+	mu_mule mule;
+	pool_init(b, &mule, threads, empty_kernel);
+	mule_start(&mule);
+	for (size_t i = 0; i < b->warmup; i++) run_batch(&mule, items);
+	for (size_t i = 0; i < b->reps; i++) samples[i] = run_batch(&mule, items) / items;
+	mule_stop(&mule);
+	mule_destroy(&mule);
+	record(b, "item", "ns/item", threads, items, samples);
+}
+
+static void bench_roundtrip(bench *b, size_t threads, size_t items, double *samples)
+{
+	mu_mule mule;
+	pool_init(b, &mule, threads, empty_kernel);
+	mule_start(&mule);
+	for (size_t batch = 1; batch <= items; batch *= 10) {
+		for (size_t i = 0; i < b->warmup; i++) run_batch(&mule, batch);
+		for (size_t i = 0; i < b->reps; i++) samples[i] = run_batch(&mule, batch);
+		record(b, "roundtrip", "ns", threads, batch, samples);
+	}
+	mule_stop(&mule);
+	mule_destroy(&mule);
+}
+
+static void bench_startstop(bench *b, size_t threads, double *samples)
+{
+	mu_mule mule;
+	pool_init(b, &mule, threads, empty_kernel);
+	for (size_t i = 0; i < b->warmup + b->reps; i++) {
+		uint64_t t0 = now_ns();
+		mule_start(&mule);
+		mule_stop(&mule);
+		if (i >= b->warmup) samples[i - b->warmup] = (double)(now_ns() - t0);
+	}
+	mule_destroy(&mule);
+	record(b, "startstop", "ns", threads, 0, samples);
+}
+
+static void bench_throughput(bench *b, size_t threads, size_t items, double *samples)
+{
+	mu_mule mule;
+	pool_init(b, &mule, threads, spin_kernel);
+	mule_start(&mule);
+	for (size_t i = 0; i < b->warmup; i++) run_batch(&mule, items);
+	for (size_t i = 0; i < b->reps; i++) samples[i] = items * 1e9 / run_batch(&mule, items);
+	mule_stop(&mule);
+	mule_destroy(&mule);
+	record(b, "throughput", "items/s", threads, items, samples);
+}
+
+static int write_json(bench *b, const char *path)
+{
+	FILE *f = fopen(path, "w");
+	if (!f) return -1;
+	fprintf(f, "{\n  \"bench\": \"mumule\",\n  \"nproc\": %ld,\n  \"reps\": %zu,\n"
+		"  \"warmup\": %zu,\n  \"affinity\": %d,\n  \"results\": [\n",
+		sysconf(_SC_NPROCESSORS_ONLN), b->reps, b->warmup, b->affinity);
+	for (size_t i = 0; i < b->num_results; i++) {
+		result *r = &b->results[i];
+		fprintf(f, "    { \"name\": \"%s\", \"unit\": \"%s\", \"threads\": %zu, "
+			"\"batch\": %zu, \"median\": %.3f, \"ci_lo\": %.3f, \"ci_hi\": %.3f, "
+			"\"min\": %.3f, \"max\": %.3f, \"reps\": %zu, \"samples\": [",
+			r->name, r->unit, r->threads, r->batch, r->median, r->ci_lo, r->ci_hi,
+			r->min, r->max, r->reps);
+		for (size_t j = 0; j < r->reps; j++) {
+			fprintf(f, "%s%.3f", j ? ", " : "", r->samples[j]);
+		}
+		fprintf(f, "] }%s\n", i + 1 < b->num_results ? "," : "");
+	}
+	fprintf(f, "  ]\n}\n");
+	return fclose(f);
+}
+
+static int write_csv(bench *b, const char *path)
+{
+	FILE *f = fopen(path, "w");
+	if (!f) return -1;
+	fprintf(f, "name,unit,threads,batch,median,ci_lo,ci_hi,min,max,reps\n");
+	for (size_t i = 0; i < b->num_results; i++) {
+		result *r = &b->results[i];
+		fprintf(f, "%s,%s,%zu,%zu,%.3f,%.3f,%.3f,%.3f,%.3f,%zu\n", r->name, r->unit,
+			r->threads, r->batch, r->median, r->ci_lo, r->ci_hi, r->min, r->max, r->reps);
+	}
+	return fclose(f);
+}
+
+/* find `"key": ` in a result line and return the value after it */
+static const char *json_value(const char *line, const char *key)
+{
+	char pat[32];
+	snprintf(pat, sizeof(pat), "\"%s\": ", key);
+	const char *p = strstr(line, pat);
+	return p ? p + strlen(pat) : NULL;
+}
+
+/*
+ * read the results of a baseline written by write_json, one result per
+ * line. only the fields needed for comparison are read.
+ */
+static int read_json(bench *b, const char *path)
+{
+	FILE *f = fopen(path, "r");
+	char line[65536], name[32];
+	if (!f) return -1;
+	while (fgets(line, sizeof(line), f)) {
+		const char *v[7] = {
+			json_value(line, "name"), json_value(line, "threads"),
+			json_value(line, "batch"), json_value(line, "median"),
+			json_value(line, "ci_lo"), json_value(line, "ci_hi"),
+			json_value(line, "reps")
+		};
+		int ok = 1;
+		for (int i = 0; i < 7; i++) ok &= v[i] != NULL;
+		if (!ok || sscanf(v[0], "\"%31[^\"]\"", name) != 1) continue;
+		if (b->num_results == b->max_results) {
+			b->max_results = b->max_results ? b->max_results * 2 : 64;
+			assert((b->results = realloc(b->results, b->max_results * sizeof(result))));
+		}
+		result r = { strdup(name), NULL, strtoul(v[1], NULL, 10), strtoul(v[2], NULL, 10),
+			strtod(v[3], NULL), 0, 0, strtod(v[4], NULL), strtod(v[5], NULL),
+			strtoul(v[6], NULL, 10), NULL };
+		b->results[b->num_results++] = r;
+	}
+	fclose(f);
+	return b->num_results ? 0 : -1;
+}
+
+/*
+ * compare each result against the baseline. throughput is better higher,
+ * the other metrics are times and better lower. returns the number of
+ * metrics that regressed past the threshold with the interval clear of 0.
+ */
+static int compare(bench *cur, bench *base, double threshold)
+{
+	int regressed = 0;
+	printf("\n%-10s %7s %8s %14s %14s %9s %20s %s\n", "compare", "threads", "batch",
+		"baseline", "current", "change", "95% interval", "");
+	for (size_t i = 0; i < cur->num_results; i++) {
+		result *r = &cur->results[i], *o = NULL;
+		for (size_t j = 0; j < base->num_results && !o; j++) {
+			result *c = &base->results[j];
+			if (!strcmp(c->name, r->name) && c->threads == r->threads &&
+				c->batch == r->batch) o = c;
+		}
+		if (!o || o->median <= 0 || o->ci_lo <= 0) {
+			printf("%-10s %7zu %8zu %14s %14.1f %9s %20s new\n", r->name,
+				r->threads, r->batch, "-", r->median, "-", "-");
+			continue;
+		}
+		/* express the change so that positive is always worse */
+		int higher_better = !strcmp(r->unit, "items/s");
+		double change = (r->median / o->median - 1) * 100;
+		double lo = (r->ci_lo / o->ci_hi - 1) * 100, hi = (r->ci_hi / o->ci_lo - 1) * 100;
+		double worse = higher_better ? -change : change;
+		double worse_lo = higher_better ? -hi : lo;
+		const char *verdict = "";
+		if (worse > threshold && worse_lo > 0) {
+			verdict = "REGRESSED";
+			regressed++;
+		} else if (worse < -threshold && (higher_better ? lo : -hi) > 0) {
+			verdict = "improved";
+		}
+		char interval[32];
+		snprintf(interval, sizeof(interval), "[%+.1f%%, %+.1f%%]", lo, hi);
+		printf("%-10s %7zu %8zu %14.1f %14.1f %+8.1f%% %20s %s\n", r->name, r->threads,
+			r->batch, o->median, r->median, change, interval, verdict);
+	}
+	return regressed;
+}
+
+static size_t parse_list(const char *s, size_t *out, size_t max)
+{
+	size_t n = 0;
+	char *end;
+	while (*s && n < max) {
+		out[n++] = strtoul(s, &end, 10);
+		if (*end != ',') break;
+		s = end + 1;
+	}
+	return n;
+}
+
+int main(int argc, const char **argv)
+{
+	size_t threads[64], num_threads = 0, items = 1000000;
+	const char *json = NULL, *csv = NULL, *baseline = NULL;
+	double threshold = 5.0;
+	bench b = { 5, 1, 0 }, base = { 0 };
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			num_threads = parse_list(argv[++i], threads, 64);
+		} else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			items = (size_t)strtod(argv[++i], NULL);
+		} else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+			b.reps = (size_t)atol(argv[++i]);
+		} else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+			b.warmup = (size_t)atol(argv[++i]);
+		} else if (strcmp(argv[i], "-a") == 0) {
+			b.affinity = 1;
+		} else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			json = argv[++i];
+		} else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+			csv = argv[++i];
+		} else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc) {
+			baseline = argv[++i];
+		} else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+			threshold = atof(argv[++i]);
+		} else {
+			b.reps = 0;
+			break;
+		}
+	}
+	for (size_t i = 0; i < num_threads; i++) {
+		if (threads[i] == 0 || threads[i] > mumule_max_threads) b.reps = 0;
+	}
+	if (b.reps == 0 || items == 0) {
+		fprintf(stderr, "usage: %s [-t threads] [-n items] [-r reps] [-w warmup] [-a] "
+			"[-j out.json] [-c out.csv] [--compare baseline.json] [--threshold percent]\n",
+			argv[0]);
+		exit(1);
+	}
+	if (baseline && read_json(&base, baseline) < 0) {
+		fprintf(stderr, "%s: cannot read baseline %s\n", argv[0], baseline);
+		exit(1);
+	}
+	if (num_threads == 0) {
+		size_t nproc = mule_hardware_threads();
+		for (size_t t = 1; t < nproc; t *= 2) threads[num_threads++] = t;
+		threads[num_threads++] = nproc;
+	}
+
+	double *samples = calloc(b.reps, sizeof(double));
+	size_t max_threads = 0;
+	for (size_t i = 0; i < num_threads; i++) {
+		if (threads[i] > max_threads) max_threads = threads[i];
+	}
+
+	printf("%-10s %7s %8s %14s %14s %14s %14s %14s %s\n", "bench", "threads", "batch",
+		"median", "ci-lo", "ci-hi", "min", "max", "unit");
+	for (size_t i = 0; i < num_threads; i++) bench_item(&b, threads[i], items, samples);
+	bench_roundtrip(&b, max_threads, items, samples);
+	for (size_t i = 0; i < num_threads; i++) bench_startstop(&b, threads[i], samples);
+	for (size_t i = 0; i < num_threads; i++) {
+		bench_throughput(&b, threads[i], items / 100 ? items / 100 : 1, samples);
+	}
+
+	if (json && write_json(&b, json)) fprintf(stderr, "%s: cannot write %s\n", argv[0], json);
+	if (csv && write_csv(&b, csv)) fprintf(stderr, "%s: cannot write %s\n", argv[0], csv);
+
+	int regressed = baseline ? compare(&b, &base, threshold) : 0;
+	if (regressed) {
+		printf("%d metrics regressed by more than %.1f%%\n", regressed, threshold);
+	}
+
+	for (size_t i = 0; i < b.num_results; i++) free(b.results[i].samples);
+	for (size_t i = 0; i < base.num_results; i++) free((char*)base.results[i].name);
+	free(samples);
+	free(b.results);
+	free(base.results);
+	return regressed ? 2 : 0;
+}
@@ -0,0 +1,111 @@
+/*
+ * bench_sort - parallel sorts against qsort and std::sort
+ *
+ * usage: bench_sort [-n max-count] [-t threads]
+ *
+ * sorts random 64-bit keys with qsort, std::sort, mule_sort_u64 (radix)
+ * and mule_sort (sample sort) for counts from 1M up to `max-count` in
+ * powers of ten, checks the output is sorted and prints the time and rate
+ * of each. threads default to the number of online cpus.
+ */
+
+#undef NDEBUG
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "mumule.h"
+#include "mualgo.h"
+
+int debug = 0;
+
+/* std::sort baseline compiled as C++ in bench_sort_std.cc */
+void bench_std_sort_u64(uint64_t *keys, size_t count);
+
+typedef void(*bench_fn)(mu_mule *mule, uint64_t *keys, size_t count);
+
+static double now_sec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+static void run_qsort(mu_mule *mule, uint64_t *keys, size_t count)
+{
+	qsort(keys, count, sizeof(uint64_t), cmp_u64);
+}
+
+static void run_std_sort(mu_mule *mule, uint64_t *keys, size_t count)
+{
+	bench_std_sort_u64(keys, count);
+}
+
+static void run_mule_radix(mu_mule *mule, uint64_t *keys, size_t count)
+{
+	assert(!mule_sort_u64(mule, keys, NULL, count));
+}
+
+static void run_mule_sample(mu_mule *mule, uint64_t *keys, size_t count)
+{
+	assert(!mule_sort(mule, keys, count, sizeof(uint64_t), cmp_u64));
+}
+
+static void fill(uint64_t *keys, size_t count)
+{
+	uint64_t x = 88172645463325252ull;
+	for (size_t i = 0; i < count; i++) {
+		x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+		keys[i] = x;
+	}
+}
+
+static void bench(const char *name, bench_fn fn, mu_mule *mule, uint64_t *keys, size_t count)
+{
+	fill(keys, count);
+	double t0 = now_sec();
+	fn(mule, keys, count);
+	double t1 = now_sec();
+	for (size_t i = 1; i < count; i++) assert(keys[i-1] <= keys[i]);
+	printf("%-12s %12zu %10.3f s %10.1f Melem/s\n", name, count, t1 - t0,
+		count / (t1 - t0) * 1e-6);
+}
+
+int main(int argc, const char **argv)
+{
+	size_t max_count = 10000000, nthreads = 0;
+	mu_mule mule;
+	uint64_t *keys;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			max_count = (size_t)strtod(argv[++i], NULL);
+		} else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			nthreads = (size_t)atol(argv[++i]);
+		} else {
+			fprintf(stderr, "usage: %s [-n max-count] [-t threads]\n", argv[0]);
+			exit(1);
+		}
+	}
+	if (!nthreads) nthreads = mule_hardware_threads();
+
+	assert((keys = malloc(max_count * sizeof(uint64_t))));
+	mule_init(&mule, nthreads, NULL, NULL);
+	mule_start(&mule);
+
+	printf("%-12s %12s %12s %18s (threads=%zu)\n", "sort", "count", "time", "rate", nthreads);
+	for (size_t count = 1000000; count <= max_count; count *= 10) {
+		bench("qsort", run_qsort, &mule, keys, count);
+		bench("std::sort", run_std_sort, &mule, keys, count);
+		bench("mule-radix", run_mule_radix, &mule, keys, count);
+		bench("mule-sample", run_mule_sample, &mule, keys, count);
+	}
+
+	mule_destroy(&mule);
+	free(keys);
+}
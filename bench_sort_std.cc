@@ -0,0 +1,8 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+extern "C" void bench_std_sort_u64(uint64_t *keys, size_t count)
+{
+    std::sort(keys, keys + count);
+}
@@ -0,0 +1,613 @@
+/*
+ * bench_workloads - application kernels across scheduling policies
+ *
+ * usage: bench_workloads [-w workloads] [-t threads] [-r reps] [-s scale]
+ *
+ * - triad: STREAM triad `a = b + s * c`, uniform and bandwidth-bound
+ * - mandelbrot: one row per unit, irregular cost
+ * - powerlaw: items with pareto-distributed cost, skewed
+ * - spmv: CSR sparse matrix-vector product with power-law row lengths,
+ *   memory-bound and irregular
+ * - quicksort: recursive quicksort run level by level, each level
+ *   partitioning every open segment in parallel, so parallelism ramps up
+ *   from a single segment
+ *
+ * each workload is split into units and run with each mumule policy:
+ *
+ * - dynamic: one unit per item
+ * - chunked: items of `units / (threads * 16)` units
+ * - static: one contiguous item per thread
+ *
+ * and, when built with OpenMP, with `parallel for` over the same units and
+ * schedule(static), schedule(dynamic, chunk) and schedule(guided). the time
+ * to solution is the median of `reps` runs and the speedup is relative to
+ * running the units serially on the calling thread. results are checked
+ * against the serial run.
+ */
+
+#undef NDEBUG
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <math.h>
+#include "mumule.h"
+
+int debug = 0;
+
+typedef void(*range_fn)(void *arg, size_t lo, size_t hi);
+
+#if defined(HAVE_OPENMP)
+/* OpenMP parallel for baseline compiled with -fopenmp in bench_workloads_omp.c */
+void bench_omp_for(int schedule, size_t chunk, size_t threads, size_t units,
+	range_fn fn, void *arg);
+#endif
+
+enum { policy_dynamic, policy_chunked, policy_static, policy_count };
+
+static const char *policy_names[] = { "dynamic", "chunked", "static" };
+
+typedef struct workload workload;
+
+struct workload
+{
+	const char *name;
+	void (*setup)(workload *w, size_t scale);
+	/* restore inputs before a run */
+	void (*reset)(workload *w);
+	/* units of the next phase, zero when done */
+	size_t (*phase)(workload *w, size_t phase);
+	void (*run)(void *arg, size_t lo, size_t hi);
+	/* checksum compared against the serial run */
+	double (*check)(workload *w);
+	void (*teardown)(workload *w);
+	void *data;
+};
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t xorshift(uint64_t *x)
+{
+	*x ^= *x << 13; *x ^= *x >> 7; *x ^= *x << 17;
+	return *x;
+}
+
+/* pareto-distributed integer in [1, max] with shape alpha */
+static size_t pareto(uint64_t *x, double alpha, size_t max)
+{
+	double u = ((xorshift(x) >> 11) + 1) * (1.0 / 9007199254740993.0);
+	double v = pow(u, -1.0 / alpha);
+	return v > max ? max : (size_t)v;
+}
+
+static size_t single_phase(workload *w, size_t phase, size_t units)
+{
+	return phase == 0 ? units : 0;
+}
+
+/* triad */
+
+enum { triad_block = 4096 };
+
+typedef struct { double *a, *b, *c; size_t n; } triad_data;
+
+static void triad_setup(workload *w, size_t scale)
+{
+	triad_data *d = calloc(1, sizeof(triad_data));
+	d->n = (size_t)1 << 21 << scale;
+	assert((d->a = malloc(d->n * sizeof(double))));
+	assert((d->b = malloc(d->n * sizeof(double))));
+	assert((d->c = malloc(d->n * sizeof(double))));
+	for (size_t i = 0; i < d->n; i++) {
+		d->b[i] = (double)(i & 1023);
+		d->c[i] = 2.0;
+	}
+	w->data = d;
+}
+
+static void triad_reset(workload *w)
+{
+	triad_data *d = (triad_data*)w->data;
+	memset(d->a, 0, d->n * sizeof(double));
+}
+
+static size_t triad_phase(workload *w, size_t phase)
+{
+	triad_data *d = (triad_data*)w->data;
+	return single_phase(w, phase, (d->n + triad_block - 1) / triad_block);
+}
+
+static void triad_run(void *arg, size_t lo, size_t hi)
+{
+	triad_data *d = (triad_data*)((workload*)arg)->data;
+	size_t end = hi * triad_block < d->n ? hi * triad_block : d->n;
+	for (size_t i = lo * triad_block; i < end; i++) d->a[i] = d->b[i] + 3.0 * d->c[i];
+}
+
+static double triad_check(workload *w)
+{
+	triad_data *d = (triad_data*)w->data;
+	double sum = 0;
+	for (size_t i = 0; i < d->n; i++) sum += d->a[i];
+	return sum;
+}
+
+static void triad_teardown(workload *w)
+{
+	triad_data *d = (triad_data*)w->data;
+	free(d->a);
+	free(d->b);
+	free(d->c);
+	free(d);
+}
+
+/* mandelbrot */
+
+typedef struct { uint16_t *iters; size_t width, height, max_iter; } mandel_data;
+
+static void mandel_setup(workload *w, size_t scale)
+{
+	mandel_data *d = calloc(1, sizeof(mandel_data));
+	d->width = d->height = (size_t)512 << (scale / 2);
+	d->max_iter = 256;
+	assert((d->iters = malloc(d->width * d->height * sizeof(uint16_t))));
+	w->data = d;
+}
+
+static void mandel_reset(workload *w)
+{
+	mandel_data *d = (mandel_data*)w->data;
+	memset(d->iters, 0, d->width * d->height * sizeof(uint16_t));
+}
+
+static size_t mandel_phase(workload *w, size_t phase)
+{
+	return single_phase(w, phase, ((mandel_data*)w->data)->height);
+}
+
+static void mandel_run(void *arg, size_t lo, size_t hi)
+{
+	mandel_data *d = (mandel_data*)((workload*)arg)->data;
+	for (size_t y = lo; y < hi; y++) {
+		double ci = -1.25 + 2.5 * y / d->height;
+		for (size_t x = 0; x < d->width; x++) {
+			double cr = -2.0 + 2.5 * x / d->width, zr = 0, zi = 0;
+			size_t k = 0;
+			while (k < d->max_iter && zr * zr + zi * zi < 4.0) {
+				double t = zr * zr - zi * zi + cr;
+				zi = 2 * zr * zi + ci;
+				zr = t;
+				k++;
+			}
+			d->iters[y * d->width + x] = (uint16_t)k;
+		}
+	}
+}
+
+static double mandel_check(workload *w)
+{
+	mandel_data *d = (mandel_data*)w->data;
+	double sum = 0;
+	for (size_t i = 0; i < d->width * d->height; i++) sum += d->iters[i];
+	return sum;
+}
+
+static void mandel_teardown(workload *w)
+{
+	mandel_data *d = (mandel_data*)w->data;
+	free(d->iters);
+	free(d);
+}
+
+/* powerlaw */
+
+typedef struct { uint32_t *cost; uint64_t *out; size_t n; } power_data;
+
+static void power_setup(workload *w, size_t scale)
+{
+	power_data *d = calloc(1, sizeof(power_data));
+	uint64_t x = 88172645463325252ull;
+	d->n = (size_t)16384 << scale;
+	assert((d->cost = malloc(d->n * sizeof(uint32_t))));
+	assert((d->out = malloc(d->n * sizeof(uint64_t))));
+	for (size_t i = 0; i < d->n; i++) d->cost[i] = (uint32_t)(64 * pareto(&x, 1.1, 100000));
+	w->data = d;
+}
+
+static void power_reset(workload *w)
+{
+	power_data *d = (power_data*)w->data;
+	memset(d->out, 0, d->n * sizeof(uint64_t));
+}
+
+static size_t power_phase(workload *w, size_t phase)
+{
+	return single_phase(w, phase, ((power_data*)w->data)->n);
+}
+
+static void power_run(void *arg, size_t lo, size_t hi)
+{
+	power_data *d = (power_data*)((workload*)arg)->data;
+	for (size_t i = lo; i < hi; i++) {
+		uint64_t x = i + 1;
+		for (uint32_t k = 0; k < d->cost[i]; k++) x = x * 6364136223846793005ull + 1;
+		d->out[i] = x;
+	}
+}
+
+static double power_check(workload *w)
+{
+	power_data *d = (power_data*)w->data;
+	double sum = 0;
+	for (size_t i = 0; i < d->n; i++) sum += (double)(d->out[i] >> 40);
+	return sum;
+}
+
+static void power_teardown(workload *w)
+{
+	power_data *d = (power_data*)w->data;
+	free(d->cost);
+	free(d->out);
+	free(d);
+}
+
+/* spmv */
+
+typedef struct {
+	size_t rows, cols;
+	size_t *row_ptr;
+	uint32_t *col;
+	double *val, *x, *y;
+} spmv_data;
+
+static void spmv_setup(workload *w, size_t scale)
+{
+	spmv_data *d = calloc(1, sizeof(spmv_data));
+	uint64_t s = 0x9e3779b97f4a7c15ull;
+	d->rows = d->cols = (size_t)1 << 18 << scale;
+	assert((d->row_ptr = malloc((d->rows + 1) * sizeof(size_t))));
+	d->row_ptr[0] = 0;
+	for (size_t r = 0; r < d->rows; r++) {
+		d->row_ptr[r + 1] = d->row_ptr[r] + 4 * pareto(&s, 1.5, 256);
+	}
+	size_t nnz = d->row_ptr[d->rows];
+	assert((d->col = malloc(nnz * sizeof(uint32_t))));
+	assert((d->val = malloc(nnz * sizeof(double))));
+	assert((d->x = malloc(d->cols * sizeof(double))));
+	assert((d->y = malloc(d->rows * sizeof(double))));
+	for (size_t i = 0; i < nnz; i++) {
+		d->col[i] = (uint32_t)(xorshift(&s) % d->cols);
+		d->val[i] = 1.0 / (1 + (i & 7));
+	}
+	for (size_t i = 0; i < d->cols; i++) d->x[i] = (double)(i & 255);
+	w->data = d;
+}
+
+static void spmv_reset(workload *w)
+{
+	spmv_data *d = (spmv_data*)w->data;
+	memset(d->y, 0, d->rows * sizeof(double));
+}
+
+static size_t spmv_phase(workload *w, size_t phase)
+{
+	return single_phase(w, phase, ((spmv_data*)w->data)->rows);
+}
+
+static void spmv_run(void *arg, size_t lo, size_t hi)
+{
+	spmv_data *d = (spmv_data*)((workload*)arg)->data;
+	for (size_t r = lo; r < hi; r++) {
+		double sum = 0;
+		for (size_t i = d->row_ptr[r]; i < d->row_ptr[r + 1]; i++) {
+			sum += d->val[i] * d->x[d->col[i]];
+		}
+		d->y[r] = sum;
+	}
+}
+
+static double spmv_check(workload *w)
+{
+	spmv_data *d = (spmv_data*)w->data;
+	double sum = 0;
+	for (size_t i = 0; i < d->rows; i++) sum += d->y[i];
+	return sum;
+}
+
+static void spmv_teardown(workload *w)
+{
+	spmv_data *d = (spmv_data*)w->data;
+	free(d->row_ptr);
+	free(d->col);
+	free(d->val);
+	free(d->x);
+	free(d->y);
+	free(d);
+}
+
+/* quicksort */
+
+enum { sort_leaf = 4096 };
+
+typedef struct { size_t lo, hi; } segment;
+
+typedef struct {
+	uint64_t *keys, *input;
+	size_t n;
+	segment *cur, *next;
+	size_t num_cur;
+} sort_data;
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+static void sort_setup(workload *w, size_t scale)
+{
+	sort_data *d = calloc(1, sizeof(sort_data));
+	uint64_t x = 88172645463325252ull;
+	d->n = (size_t)1 << 20 << scale;
+	assert((d->keys = malloc(d->n * sizeof(uint64_t))));
+	assert((d->input = malloc(d->n * sizeof(uint64_t))));
+	/* at most two children per segment longer than a leaf, two slots each */
+	assert((d->cur = malloc((d->n / sort_leaf + 2) * 4 * sizeof(segment))));
+	assert((d->next = malloc((d->n / sort_leaf + 2) * 4 * sizeof(segment))));
+	for (size_t i = 0; i < d->n; i++) d->input[i] = xorshift(&x);
+	w->data = d;
+}
+
+static void sort_reset(workload *w)
+{
+	sort_data *d = (sort_data*)w->data;
+	memcpy(d->keys, d->input, d->n * sizeof(uint64_t));
+}
+
+/* gather the children written by the last level into the next level */
+static size_t sort_phase(workload *w, size_t phase)
+{
+	sort_data *d = (sort_data*)w->data;
+	if (phase == 0) {
+		d->cur[0] = (segment) { 0, d->n };
+		return d->num_cur = 1;
+	}
+	size_t n = 0;
+	for (size_t i = 0; i < d->num_cur * 2; i++) {
+		if (d->next[i].hi > d->next[i].lo) d->cur[n++] = d->next[i];
+	}
+	return d->num_cur = n;
+}
+
+static void sort_run(void *arg, size_t lo, size_t hi)
+{
+	sort_data *d = (sort_data*)((workload*)arg)->data;
+	for (size_t s = lo; s < hi; s++) {
+		size_t l = d->cur[s].lo, h = d->cur[s].hi;
+		d->next[2 * s] = d->next[2 * s + 1] = (segment) { 0, 0 };
+		if (h - l <= sort_leaf) {
+			qsort(d->keys + l, h - l, sizeof(uint64_t), cmp_u64);
+			continue;
+		}
+		/* hoare partition around the median of three */
+		uint64_t *k = d->keys, a = k[l], b = k[l + (h - l) / 2], c = k[h - 1];
+		uint64_t pivot = a < b ? (b < c ? b : (a < c ? c : a)) : (a < c ? a : (b < c ? c : b));
+		size_t i = l, j = h - 1;
+		for (;;) {
+			while (k[i] < pivot) i++;
+			while (k[j] > pivot) j--;
+			if (i >= j) break;
+			uint64_t t = k[i]; k[i] = k[j]; k[j] = t;
+			i++; j--;
+		}
+		d->next[2 * s] = (segment) { l, j + 1 };
+		d->next[2 * s + 1] = (segment) { j + 1, h };
+	}
+}
+
+static double sort_check(workload *w)
+{
+	sort_data *d = (sort_data*)w->data;
+	for (size_t i = 1; i < d->n; i++) {
+		if (d->keys[i - 1] > d->keys[i]) return -1;
+	}
+	return (double)(d->keys[d->n / 2] >> 12);
+}
+
+static void sort_teardown(workload *w)
+{
+	sort_data *d = (sort_data*)w->data;
+	free(d->keys);
+	free(d->input);
+	free(d->cur);
+	free(d->next);
+	free(d);
+}
+
+static workload workloads[] = {
+	{ "triad", triad_setup, triad_reset, triad_phase,
+		triad_run, triad_check, triad_teardown },
+	{ "mandelbrot", mandel_setup, mandel_reset, mandel_phase,
+		mandel_run, mandel_check, mandel_teardown },
+	{ "powerlaw", power_setup, power_reset, power_phase,
+		power_run, power_check, power_teardown },
+	{ "spmv", spmv_setup, spmv_reset, spmv_phase,
+		spmv_run, spmv_check, spmv_teardown },
+	{ "quicksort", sort_setup, sort_reset, sort_phase,
+		sort_run, sort_check, sort_teardown },
+};
+
+/* runs items of `grain` units, counting from the queue index before submit */
+typedef struct { workload *w; size_t base, grain, units; } job;
+
+static void job_kernel(void *arg, size_t thr_idx, size_t item_idx)
+{
+	job *j = (job*)arg;
+	size_t lo = (item_idx - j->base - 1) * j->grain, hi = lo + j->grain;
+	j->w->run(j->w, lo, hi < j->units ? hi : j->units);
+}
+
+static void run_serial(workload *w)
+{
+	size_t units;
+	for (size_t p = 0; (units = w->phase(w, p)); p++) w->run(w, 0, units);
+}
+
+static void run_mule(workload *w, mu_mule *mule, job *j, int policy)
+{
+	size_t units, threads = mule->num_threads;
+	for (size_t p = 0; (units = w->phase(w, p)); p++) {
+		switch (policy) {
+		case policy_dynamic: j->grain = 1; break;
+		case policy_chunked: j->grain = units / (threads * 16); break;
+		default: j->grain = (units + threads - 1) / threads; break;
+		}
+		if (j->grain == 0) j->grain = 1;
+		j->units = units;
+		j->base = atomic_load(&mule->queued);
+		mule_submit(mule, (units + j->grain - 1) / j->grain);
+		mule_sync(mule);
+	}
+}
+
+#if defined(HAVE_OPENMP)
+static const char *omp_names[] = { "static", "dynamic", "guided" };
+
+static void run_omp(workload *w, int schedule, size_t threads)
+{
+	size_t units;
+	for (size_t p = 0; (units = w->phase(w, p)); p++) {
+		size_t chunk = units / (threads * 16);
+		bench_omp_for(schedule, chunk ? chunk : 1, threads, units, w->run, w);
+	}
+}
+#endif
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+static double median(double *t, size_t n)
+{
+	qsort(t, n, sizeof(double), cmp_double);
+	return n & 1 ? t[n / 2] : (t[n / 2 - 1] + t[n / 2]) / 2;
+}
+
+static void report(workload *w, const char *runtime, const char *policy, size_t threads,
+	double ms, double serial_ms, double sum, double expect)
+{
+	/* the sums differ only by the order of floating-point additions */
+	int ok = fabs(sum - expect) <= 1e-9 * fabs(expect) && sum >= 0;
+	printf("%-10s %-7s %-8s %7zu %12.3f %8.2f%s\n", w->name, runtime, policy, threads,
+		ms, serial_ms / ms, ok ? "" : " MISMATCH");
+	fflush(stdout);
+	if (!ok) exit(1);
+}
+
+static size_t parse_list(const char *s, size_t *out, size_t max)
+{
+	size_t n = 0;
+	char *end;
+	while (*s && n < max) {
+		out[n++] = strtoul(s, &end, 10);
+		if (*end != ',') break;
+		s = end + 1;
+	}
+	return n;
+}
+
+int main(int argc, const char **argv)
+{
+	const size_t num_workloads = sizeof(workloads) / sizeof(workloads[0]);
+	size_t threads[64], num_threads = 0, reps = 3, scale = 0;
+	const char *only = NULL;
+	int usage = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+			only = argv[++i];
+		} else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			num_threads = parse_list(argv[++i], threads, 64);
+		} else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+			reps = (size_t)atol(argv[++i]);
+		} else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			scale = (size_t)atol(argv[++i]);
+		} else {
+			usage = 1;
+		}
+	}
+	for (size_t i = 0; i < num_threads; i++) {
+		if (threads[i] == 0 || threads[i] > mumule_max_threads) usage = 1;
+	}
+	if (usage || reps == 0 || reps > 64 || scale > 8) {
+		fprintf(stderr, "usage: %s [-w workloads] [-t threads] [-r reps] [-s scale]\n",
+			argv[0]);
+		exit(1);
+	}
+	if (num_threads == 0) {
+		size_t nproc = mule_hardware_threads();
+		for (size_t t = 1; t < nproc && num_threads < 63; t *= 2) threads[num_threads++] = t;
+		threads[num_threads++] = nproc;
+	}
+
+	printf("%-10s %-7s %-8s %7s %12s %8s\n", "workload", "runtime", "policy",
+		"threads", "time-ms", "speedup");
+	for (size_t k = 0; k < num_workloads; k++) {
+		workload *w = &workloads[k];
+		double t[64];
+		if (only && !strstr(only, w->name)) continue;
+
+		w->setup(w, scale);
+		for (size_t r = 0; r < reps; r++) {
+			w->reset(w);
+			uint64_t t0 = now_ns();
+			run_serial(w);
+			t[r] = (now_ns() - t0) / 1e6;
+		}
+		double serial_ms = median(t, reps), expect = w->check(w);
+		report(w, "serial", "-", 1, serial_ms, serial_ms, expect, expect);
+
+		for (size_t i = 0; i < num_threads; i++) {
+			mu_mule mule;
+			job j = { w };
+			mule_init(&mule, threads[i], job_kernel, &j);
+			mule_start(&mule);
+			for (int policy = 0; policy < policy_count; policy++) {
+				double sum = 0;
+				for (size_t r = 0; r < reps; r++) {
+					w->reset(w);
+					uint64_t t0 = now_ns();
+					run_mule(w, &mule, &j, policy);
+					t[r] = (now_ns() - t0) / 1e6;
+					sum = w->check(w);
+				}
+				report(w, "mumule", policy_names[policy], threads[i], median(t, reps),
+					serial_ms, sum, expect);
+			}
+			mule_stop(&mule);
+			mule_destroy(&mule);
+
+#if defined(HAVE_OPENMP)
+			for (int schedule = 0; schedule < 3; schedule++) {
+				double sum = 0;
+				for (size_t r = 0; r < reps; r++) {
+					w->reset(w);
+					uint64_t t0 = now_ns();
+					run_omp(w, schedule, threads[i]);
+					t[r] = (now_ns() - t0) / 1e6;
+					sum = w->check(w);
+				}
+				report(w, "openmp", omp_names[schedule], threads[i], median(t, reps),
+					serial_ms, sum, expect);
+			}
+#endif
+		}
+		w->teardown(w);
+	}
+}
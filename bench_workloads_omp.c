@@ -0,0 +1,25 @@
+#include <stddef.h>
+#include <omp.h>
+
+typedef void(*range_fn)(void *arg, size_t lo, size_t hi);
+
+/* parallel for over units with schedule 0 static, 1 dynamic or 2 guided */
+void bench_omp_for(int schedule, size_t chunk, size_t threads, size_t units,
+	range_fn fn, void *arg)
+{
+	long n = (long)units;
+	switch (schedule) {
+	case 0:
+		#pragma omp parallel for schedule(static) num_threads(threads)
+		for (long i = 0; i < n; i++) fn(arg, i, i + 1);
+		break;
+	case 1:
+		#pragma omp parallel for schedule(dynamic, chunk) num_threads(threads)
+		for (long i = 0; i < n; i++) fn(arg, i, i + 1);
+		break;
+	default:
+		#pragma omp parallel for schedule(guided) num_threads(threads)
+		for (long i = 0; i < n; i++) fn(arg, i, i + 1);
+		break;
+	}
+}
@@ -0,0 +1,1155 @@
+/*
+ * Copyright 2021, Michael Clark <micheljclark@mac.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#pragma once
+
+#include "mumule.h"
+
+#if defined(__x86_64__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/*
+ * runtime cpu dispatch:
+ *
+ * binaries are built for the baseline architecture. `MULE_TARGET_CLONES`
+ * compiles a function for AVX-512, AVX2 and the baseline and selects one
+ * at load time through an ifunc, while hand-written intrinsics live in
+ * `MULE_TARGET("avx2")` functions selected with `_mule_cpu_avx2()`.
+ */
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define MULE_X86_DISPATCH 1
+#define MULE_TARGET(x) __attribute__((target(x)))
+#if defined(__has_attribute) && defined(__ELF__)
+#if __has_attribute(target_clones)
+#define MULE_TARGET_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#endif
+#endif
+#else
+#define MULE_X86_DISPATCH 0
+#endif
+
+#ifndef MULE_TARGET_CLONES
+#define MULE_TARGET_CLONES
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * mualgo parallel algorithms:
+ *
+ * - `mule_reduce(mule, op, result)` to reduce a range with per-worker partials
+ * - `mule_scan_u32(mule, out, in, count, flags)` for 32-bit prefix sums
+ * - `mule_scan_u64(mule, out, in, count, flags)` for 64-bit prefix sums
+ * - `mule_sort_u32(mule, keys, vals, count)` to radix sort 32-bit keys
+ * - `mule_sort_u64(mule, keys, vals, count)` to radix sort 64-bit keys
+ * - `mule_sort(mule, base, count, size, cmp)` to sample sort with a comparator
+ * - `mule_compact(mule, out, in, count, size, pred, arg)` to filter elements
+ * - `mule_compact_idx(mule, out, count, pred, arg)` to filter indices
+ * - `mule_partition(mule, out, in, count, size, pred, arg)` to stable partition
+ * - `mule_memcpy(mule, dst, src, n, flags)` to copy large buffers
+ * - `mule_memset(mule, dst, c, n, flags)` to fill large buffers
+ * - `mule_first_touch(mule, dst, n)` to zero and place pages across workers
+ *
+ * algorithms run on a transient arena attached to `mule` (or to its host
+ * if `mule` is itself an arena) so they share the pool workers with any
+ * other queues and may be used while the pool has work of its own. they
+ * operate on zero-based element ranges [0, count) and must be called from
+ * the dispatching thread, not from within a kernel. if the pool is not
+ * running, or all arena slots are in use, the work runs on the caller.
+ */
+
+typedef void(*mumule_accumulate_fn)(void *arg, void *acc, size_t begin, size_t end);
+typedef void(*mumule_accumulate_item_fn)(void *arg, void *acc, size_t idx);
+typedef void(*mumule_combine_fn)(void *arg, void *acc, const void *rhs);
+typedef int(*mumule_compare_fn)(const void *a, const void *b);
+typedef int(*mumule_predicate_fn)(void *arg, size_t thr_idx, size_t idx);
+
+struct mu_reduce_op;
+typedef struct mu_reduce_op mu_reduce_op;
+
+static int mule_reduce(mu_mule *mule, const mu_reduce_op *op, void *result);
+static int mule_scan_u32(mu_mule *mule, uint32_t *out, const uint32_t *in, size_t count,
+    int flags);
+static int mule_scan_u64(mu_mule *mule, uint64_t *out, const uint64_t *in, size_t count,
+    int flags);
+static int mule_sort_u32(mu_mule *mule, uint32_t *keys, uint64_t *vals, size_t count);
+static int mule_sort_u64(mu_mule *mule, uint64_t *keys, uint64_t *vals, size_t count);
+static int mule_sort(mu_mule *mule, void *base, size_t count, size_t size,
+    mumule_compare_fn cmp);
+static size_t mule_compact(mu_mule *mule, void *out, const void *in, size_t count,
+    size_t size, mumule_predicate_fn pred, void *userdata);
+static size_t mule_compact_idx(mu_mule *mule, size_t *out, size_t count,
+    mumule_predicate_fn pred, void *userdata);
+static size_t mule_partition(mu_mule *mule, void *out, const void *in, size_t count,
+    size_t size, mumule_predicate_fn pred, void *userdata);
+static void mule_memcpy(mu_mule *mule, void *dst, const void *src, size_t n, int flags);
+static void mule_memset(mu_mule *mule, void *dst, int c, size_t n, int flags);
+static void mule_first_touch(mu_mule *mule, void *dst, size_t n);
+
+enum {
+    mumule_cache_line_size = 64,
+    mumule_chunks_per_thread = 8,
+    mumule_reduce_deterministic_grain = 4096,
+    mumule_scan_min_block = 1 << 16,
+    mumule_sort_min_block = 1 << 14,
+    mumule_radix_bits = 8,
+    mumule_radix_buckets = 1 << mumule_radix_bits,
+    mumule_sample_max_buckets = 256,
+    mumule_sample_oversample = 16,
+    mumule_compact_min_block = 1 << 12,
+    mumule_mem_min_parallel = 1 << 18,
+    mumule_mem_min_chunk = 1 << 16,
+    mumule_mem_nontemporal_threshold = 8 << 20,
+};
+
+enum {
+    mumule_reduce_deterministic = (1 << 0),
+};
+
+enum {
+    mumule_mem_nontemporal = (1 << 0),
+    mumule_mem_temporal = (1 << 1),
+    mumule_mem_thread_affine = (1 << 2),
+};
+
+enum {
+    mumule_scan_exclusive = 0,
+    mumule_scan_inclusive = (1 << 0),
+};
+
+/*
+ * scan:
+ *
+ * two-pass blocked prefix sum. the first pass sums each block in parallel,
+ * the block sums are scanned on the caller, and the second pass scans each
+ * block in parallel starting from its offset. blocks are at least 64K
+ * elements so the serial step is negligible and each block streams through
+ * the cache. the block scan uses AVX2 when the cpu supports it. `out` may
+ * equal `in`. sums wrap modulo the element width.
+ */
+
+/*
+ * sort:
+ *
+ * `mule_sort_u32` and `mule_sort_u64` are stable LSD radix sorts on 8-bit
+ * digits with an optional 64-bit payload per key (`vals` may be NULL).
+ * each pass builds a digit histogram per block in parallel, turns them
+ * into per-block offsets on the caller and scatters blocks in parallel.
+ * passes where every key has the same digit are skipped.
+ *
+ * `mule_sort` is a sample sort for arbitrary elements and a qsort-style
+ * comparator. splitters are chosen from a random oversampled sorted sample,
+ * elements are classified and scattered into buckets in parallel, then
+ * the buckets are sorted with qsort in parallel. elements and splitters
+ * compare by key then position, so a run of duplicate keys spans as many
+ * buckets as its share of the sample. it is not stable.
+ *
+ * the temporaries are malloc'd on the caller. they are shared by every
+ * worker across passes, which per-worker scratch cannot express, and
+ * `mumule_scratch_reset_on_sync` would release scratch between passes.
+ */
+
+/*
+ * compaction:
+ *
+ * predicates are called like a kernel with `arg` and `thr_idx`, but with
+ * the zero-based element index rather than a one-based item index, and
+ * return non-zero to keep the element. the first pass evaluates the
+ * predicate once per element in parallel, setting bits in a bitmap and
+ * counting matches per block. block offsets are then scanned on the caller
+ * and the second pass scatters each block densely into `out`. blocks cover
+ * whole bitmap words so there are no per-item atomics. `mule_compact`
+ * copies kept elements, `mule_compact_idx` writes their indices and
+ * `mule_partition` writes kept elements followed by the rest, preserving
+ * order in both. all return the number of kept elements or (size_t)-1 if
+ * out of memory. `out` must not overlap `in`.
+ */
+
+/*
+ * bulk memory:
+ *
+ * `mule_memcpy` and `mule_memset` split buffers into page-aligned chunks
+ * across workers. buffers of 8 MiB or more are written with non-temporal
+ * stores so they do not evict the working set, unless `mumule_mem_temporal`
+ * is given; `mumule_mem_nontemporal` forces streaming for smaller sizes.
+ * small buffers are handled on the caller.
+ *
+ * `mumule_mem_thread_affine` deals chunks round-robin to workers instead of
+ * dynamically, chunk k going to the set of worker k % nthreads, so that with
+ * Linux first-touch placement each page lands on the NUMA node of a worker
+ * that processes it with the same thread-strided mapping. a worker that
+ * finds its set already taken takes the first unclaimed set instead, so a
+ * straggling worker costs placement, never correctness. `mule_first_touch`
+ * zero-fills freshly mapped memory this way.
+ */
+
+/*
+ * reduction:
+ *
+ * - `elem_size` and `identity` - size and identity value of the accumulator
+ * - `count` and `grain` - reduce [0, count) in chunks of `grain` elements
+ * - `accumulate` - accumulate the range [begin, end) into `acc`, or
+ * - `accumulate_item` - accumulate one element into `acc`
+ * - `combine` - combine accumulator `rhs` into `acc`
+ *
+ * partials are padded to cache lines and kept per-worker, then combined
+ * tree-wise on the caller after sync. `mumule_reduce_deterministic` keeps
+ * one partial per fixed-size chunk instead, so the combine order does not
+ * depend on thread count or scheduling and floating-point results are
+ * reproducible run-to-run.
+ */
+
+struct mu_reduce_op
+{
+    size_t                     elem_size;
+    const void*                identity;
+    size_t                     count;
+    size_t                     grain;
+    mumule_accumulate_fn       accumulate;
+    mumule_accumulate_item_fn  accumulate_item;
+    mumule_combine_fn          combine;
+    void*                      userdata;
+    int                        flags;
+};
+
+/*
+ * mualgo implementation
+ */
+
+static inline size_t _mule_round_up(size_t n, size_t align)
+{
+    return (n + align - 1) & ~(align - 1);
+}
+
+static inline size_t _mule_min(size_t a, size_t b)
+{
+    return a < b ? a : b;
+}
+
+static inline size_t _mule_algo_threads(mu_mule *mule)
+{
+    size_t n = _mule_host(mule)->num_threads;
+    return n ? n : 1;
+}
+
+/* pick a grain that gives each worker several chunks to balance load */
+static inline size_t _mule_algo_grain(mu_mule *mule, size_t count, size_t grain)
+{
+    if (grain) return grain;
+    grain = count / (_mule_algo_threads(mule) * mumule_chunks_per_thread);
+    return grain ? grain : 1;
+}
+
+static inline size_t _mule_algo_chunks(size_t count, size_t grain)
+{
+    return (count + grain - 1) / grain;
+}
+
+/*
+ * run `count` items of `kernel` on a transient arena attached to the
+ * host of `mule`, or on the caller when no workers are available.
+ */
+static void _mule_parallel(mu_mule *mule, size_t count, mumule_work_fn kernel, void *userdata)
+{
+    mu_mule *host = _mule_host(mule);
+    mu_mule arena;
+
+    if (!count) return;
+
+    if (host->num_threads && (host->lazy_start || atomic_load(&host->running))) {
+        mule_init(&arena, 0, kernel, userdata);
+        if (!mule_attach(&arena, host, 0)) {
+            mule_submit(&arena, count);
+            mule_sync(&arena);
+            mule_destroy(&arena);
+            return;
+        }
+        mule_destroy(&arena);
+    }
+
+    for (size_t idx = 1; idx <= count; idx++) {
+        kernel(userdata, 0, idx);
+    }
+}
+
+/* combine partials pairwise in a fixed tree order into partial zero */
+static void _mule_combine_tree(const mu_reduce_op *op, char *partials, size_t stride, size_t n)
+{
+    for (size_t step = 1; step < n; step <<= 1) {
+        for (size_t i = 0; i + step < n; i += step << 1) {
+            op->combine(op->userdata, partials + i * stride, partials + (i + step) * stride);
+        }
+    }
+}
+
+typedef struct {
+    const mu_reduce_op *op;
+    char *partials;
+    size_t stride;
+    size_t grain;
+    int per_chunk;
+} _mu_reduce_ctx;
+
+static void _mule_reduce_kernel(void *arg, size_t thr_idx, size_t item_idx)
+{
+    _mu_reduce_ctx *ctx = (_mu_reduce_ctx*)arg;
+    const mu_reduce_op *op = ctx->op;
+    size_t chunk = item_idx - 1;
+    size_t begin = chunk * ctx->grain;
+    size_t end = _mule_min(begin + ctx->grain, op->count);
+    void *acc = ctx->partials + (ctx->per_chunk ? chunk : thr_idx) * ctx->stride;
+
+    if (op->accumulate) {
+        op->accumulate(op->userdata, acc, begin, end);
+    } else {
+        for (size_t i = begin; i < end; i++) {
+            op->accumulate_item(op->userdata, acc, i);
+        }
+    }
+}
+
+static int mule_reduce(mu_mule *mule, const mu_reduce_op *op, void *result)
+{
+    _mu_reduce_ctx ctx;
+    size_t chunks, npartials;
+
+    assert(op->combine && (op->accumulate || op->accumulate_item));
+
+    if (!op->count) {
+        memcpy(result, op->identity, op->elem_size);
+        return 0;
+    }
+
+    ctx.op = op;
+    ctx.per_chunk = (op->flags & mumule_reduce_deterministic) != 0;
+    ctx.grain = op->grain ? op->grain : ctx.per_chunk
+        ? mumule_reduce_deterministic_grain : _mule_algo_grain(mule, op->count, 0);
+    ctx.stride = _mule_round_up(op->elem_size, mumule_cache_line_size);
+    chunks = _mule_algo_chunks(op->count, ctx.grain);
+    npartials = ctx.per_chunk ? chunks : _mule_algo_threads(mule);
+
+    ctx.partials = (char*)aligned_alloc(mumule_cache_line_size, npartials * ctx.stride);
+    if (!ctx.partials) return -1;
+    for (size_t i = 0; i < npartials; i++) {
+        memcpy(ctx.partials + i * ctx.stride, op->identity, op->elem_size);
+    }
+
+    _mule_parallel(mule, chunks, _mule_reduce_kernel, &ctx);
+    _mule_combine_tree(op, ctx.partials, ctx.stride, npartials);
+
+    memcpy(result, ctx.partials, op->elem_size);
+    free(ctx.partials);
+
+    return 0;
+}
+
+static inline int _mule_cpu_avx2()
+{
+#if MULE_X86_DISPATCH
+    return __builtin_cpu_supports("avx2");
+#else
+    return 0;
+#endif
+}
+
+MULE_TARGET_CLONES
+static uint64_t _mule_sum_u32(const uint32_t *in, size_t n)
+{
+    uint32_t sum = 0;
+    for (size_t i = 0; i < n; i++) sum += in[i];
+    return sum;
+}
+
+MULE_TARGET_CLONES
+static uint64_t _mule_sum_u64(const uint64_t *in, size_t n)
+{
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; i++) sum += in[i];
+    return sum;
+}
+
+#if MULE_X86_DISPATCH
+/* in-register prefix sums, returning the number of elements scanned */
+MULE_TARGET("avx2")
+static size_t _mule_scan_avx2_u32(uint32_t *out, const uint32_t *in, size_t n,
+    uint32_t *carry, int inclusive)
+{
+    __m256i vcarry = _mm256_set1_epi32((int)*carry);
+    __m256i vlast = _mm256_set1_epi32(7);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(in + i));
+        __m256i x = _mm256_add_epi32(v, _mm256_slli_si256(v, 4));
+        x = _mm256_add_epi32(x, _mm256_slli_si256(x, 8));
+        __m256i t = _mm256_shuffle_epi32(x, _MM_SHUFFLE(3,3,3,3));
+        x = _mm256_add_epi32(x, _mm256_permute2x128_si256(t, t, 0x08));
+        x = _mm256_add_epi32(x, vcarry);
+        vcarry = _mm256_permutevar8x32_epi32(x, vlast);
+        _mm256_storeu_si256((__m256i*)(out + i), inclusive ? x : _mm256_sub_epi32(x, v));
+    }
+    *carry = (uint32_t)_mm256_extract_epi32(vcarry, 0);
+
+    return i;
+}
+
+MULE_TARGET("avx2")
+static size_t _mule_scan_avx2_u64(uint64_t *out, const uint64_t *in, size_t n,
+    uint64_t *carry, int inclusive)
+{
+    __m256i vcarry = _mm256_set1_epi64x((long long)*carry);
+    __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(in + i));
+        __m256i x = _mm256_add_epi64(v, _mm256_slli_si256(v, 8));
+        __m256i t = _mm256_permute4x64_epi64(x, _MM_SHUFFLE(1,1,1,1));
+        x = _mm256_add_epi64(x, _mm256_blend_epi32(zero, t, 0xf0));
+        x = _mm256_add_epi64(x, vcarry);
+        vcarry = _mm256_permute4x64_epi64(x, _MM_SHUFFLE(3,3,3,3));
+        _mm256_storeu_si256((__m256i*)(out + i), inclusive ? x : _mm256_sub_epi64(x, v));
+    }
+    *carry = (uint64_t)_mm256_extract_epi64(vcarry, 0);
+
+    return i;
+}
+#endif
+
+static void _mule_scan_block_u32(uint32_t *out, const uint32_t *in, size_t n,
+    uint64_t offset, int inclusive)
+{
+    uint32_t carry = (uint32_t)offset;
+    size_t i = 0;
+
+#if MULE_X86_DISPATCH
+    if (_mule_cpu_avx2()) i = _mule_scan_avx2_u32(out, in, n, &carry, inclusive);
+#endif
+
+    for (; i < n; i++) {
+        uint32_t v = in[i];
+        out[i] = inclusive ? carry + v : carry;
+        carry += v;
+    }
+}
+
+static void _mule_scan_block_u64(uint64_t *out, const uint64_t *in, size_t n,
+    uint64_t offset, int inclusive)
+{
+    uint64_t carry = offset;
+    size_t i = 0;
+
+#if MULE_X86_DISPATCH
+    if (_mule_cpu_avx2()) i = _mule_scan_avx2_u64(out, in, n, &carry, inclusive);
+#endif
+
+    for (; i < n; i++) {
+        uint64_t v = in[i];
+        out[i] = inclusive ? carry + v : carry;
+        carry += v;
+    }
+}
+
+typedef struct {
+    void *out;
+    const void *in;
+    size_t count;
+    size_t block;
+    size_t elem_size;
+    int inclusive;
+    uint64_t *sums;
+} _mu_scan_ctx;
+
+static void _mule_scan_sum_kernel(void *arg, size_t thr_idx, size_t item_idx)
+{
+    _mu_scan_ctx *ctx = (_mu_scan_ctx*)arg;
+    size_t b = item_idx - 1, begin = b * ctx->block;
+    size_t n = _mule_min(ctx->block, ctx->count - begin);
+
+    if (ctx->elem_size == 4) {
+        ctx->sums[b] = _mule_sum_u32((const uint32_t*)ctx->in + begin, n);
+    } else {
+        ctx->sums[b] = _mule_sum_u64((const uint64_t*)ctx->in + begin, n);
+    }
+}
+
+static void _mule_scan_block_kernel(void *arg, size_t thr_idx, size_t item_idx)
+{
+    _mu_scan_ctx *ctx = (_mu_scan_ctx*)arg;
+    size_t b = item_idx - 1, begin = b * ctx->block;
+    size_t n = _mule_min(ctx->block, ctx->count - begin);
+
+    if (ctx->elem_size == 4) {
+        _mule_scan_block_u32((uint32_t*)ctx->out + begin,
+            (const uint32_t*)ctx->in + begin, n, ctx->sums[b], ctx->inclusive);
+    } else {
+        _mule_scan_block_u64((uint64_t*)ctx->out + begin,
+            (const uint64_t*)ctx->in + begin, n, ctx->sums[b], ctx->inclusive);
+    }
+}
+
+static int _mule_scan(mu_mule *mule, void *out, const void *in, size_t count,
+    size_t elem_size, int flags)
+{
+    _mu_scan_ctx ctx = { out, in, count, 0, elem_size,
+        (flags & mumule_scan_inclusive) != 0, NULL };
+    size_t blocks;
+    uint64_t offset = 0;
+
+    if (!count) return 0;
+
+    ctx.block = _mule_round_up(_mule_algo_grain(mule, count, 0), 64);
+    if (ctx.block < mumule_scan_min_block) ctx.block = mumule_scan_min_block;
+    blocks = _mule_algo_chunks(count, ctx.block);
+
+    if (!(ctx.sums = (uint64_t*)malloc(blocks * sizeof(uint64_t)))) return -1;
+
+    /* a single block needs no first pass */
+    if (blocks > 1) {
+        _mule_parallel(mule, blocks, _mule_scan_sum_kernel, &ctx);
+        for (size_t b = 0; b < blocks; b++) {
+            uint64_t sum = ctx.sums[b];
+            ctx.sums[b] = offset;
+            offset += sum;
+        }
+    } else {
+        ctx.sums[0] = 0;
+    }
+    _mule_parallel(mule, blocks, _mule_scan_block_kernel, &ctx);
+
+    free(ctx.sums);
+
+    return 0;
+}
+
+static int mule_scan_u32(mu_mule *mule, uint32_t *out, const uint32_t *in, size_t count,
+    int flags)
+{
+    return _mule_scan(mule, out, in, count, sizeof(uint32_t), flags);
+}
+
+static int mule_scan_u64(mu_mule *mule, uint64_t *out, const uint64_t *in, size_t count,
+    int flags)
+{
+    return _mule_scan(mule, out, in, count, sizeof(uint64_t), flags);
+}
+
+/*
+ * radix sort
+ */
+
+typedef struct {
+    void *keys[2];
+    uint64_t *vals[2];
+    size_t key_size;
+    size_t count;
+    size_t block;
+    size_t src;
+    size_t shift;
+    size_t *hist;
+} _mu_radix_ctx;
+
+static inline size_t _mule_radix_digit(const _mu_radix_ctx *ctx, const void *keys, size_t i)
+{
+    uint64_t key = ctx->key_size == 4 ? ((const uint32_t*)keys)[i] : ((const uint64_t*)keys)[i];
+    return (size_t)(key >> ctx->shift) & (mumule_radix_buckets - 1);
+}
+
+static void _mule_radix_hist_kernel(void *arg, size_t thr_idx, size_t item_idx)
+{
+    _mu_radix_ctx *ctx = (_mu_radix_ctx*)arg;
+    size_t b = item_idx - 1, begin = b * ctx->block;
+    size_t end = _mule_min(begin + ctx->block, ctx->count);
+    size_t *hist = ctx->hist + b * mumule_radix_buckets;
+    const void *keys = ctx->keys[ctx->src];
+
+    memset(hist, 0, mumule_radix_buckets * sizeof(size_t));
+    for (size_t i = begin; i < end; i++) {
+        hist[_mule_radix_digit(ctx, keys, i)]++;
+    }
+}
+
+static void _mule_radix_scatter_kernel(void *arg, size_t thr_idx, size_t item_idx)
+{
+    _mu_radix_ctx *ctx = (_mu_radix_ctx*)arg;
+    size_t b = item_idx - 1, begin = b * ctx->block;
+    size_t end = _mule_min(begin + ctx->block, ctx->count);
+    size_t *off = ctx->hist + b * mumule_radix_buckets;
+    const void *src = ctx->keys[ctx->src];
+    void *dst = ctx->keys[ctx->src ^ 1];
+    const uint64_t *vsrc = ctx->vals[ctx->src];
+    uint64_t *vdst = ctx->vals[ctx->src ^ 1];
+
+    for (size_t i = begin; i < end; i++) {
+        size_t j = off[_mule_radix_digit(ctx, src, i)]++;
+        if (ctx->key_size == 4) {
+            ((uint32_t*)dst)[j] = ((const uint32_t*)src)[i];
+        } else {
+            ((uint64_t*)dst)[j] = ((const uint64_t*)src)[i];
+        }
+        if (vsrc) vdst[j] = vsrc[i];
+    }
+}
+
+/*
+ * turn per-block digit counts into per-block scatter offsets, ordered by
+ * digit then block so the scatter is stable. returns zero if every key
+ * has the same digit and the pass can be skipped.
+ */
+static int _mule_radix_offsets(_mu_radix_ctx *ctx, size_t blocks)
+{
+    size_t offset = 0;
+
+    for (size_t d = 0; d < mumule_radix_buckets; d++) {
+        size_t total = 0;
+        for (size_t b = 0; b < blocks; b++) {
+            total += ctx->hist[b * mumule_radix_buckets + d];
+        }
+        if (total == ctx->count) return 0;
+        for (size_t b = 0; b < blocks; b++) {
+            size_t n = ctx->hist[b * mumule_radix_buckets + d];
+            ctx->hist[b * mumule_radix_buckets + d] = offset;
+            offset += n;
+        }
+    }
+
+    return 1;
+}
+
+static int _mule_radix_sort(mu_mule *mule, void *keys, uint64_t *vals, size_t count,
+    size_t key_size)
+{
+    _mu_radix_ctx ctx;
+    size_t blocks;
+
+    if (count < 2) return 0;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.key_size = key_size;
+    ctx.count = count;
+    ctx.block = _mule_algo_grain(mule, count, 0);
+    if (ctx.block < mumule_sort_min_block) ctx.block = mumule_sort_min_block;
+    blocks = _mule_algo_chunks(count, ctx.block);
+
+    ctx.keys[0] = keys;
+    ctx.vals[0] = vals;
+    ctx.keys[1] = malloc(count * key_size);
+    ctx.vals[1] = vals ? (uint64_t*)malloc(count * sizeof(uint64_t)) : NULL;
+    ctx.hist = (size_t*)malloc(blocks * mumule_radix_buckets * sizeof(size_t));
+    if (!ctx.keys[1] || (vals && !ctx.vals[1]) || !ctx.hist) {
+        free(ctx.keys[1]);
+        free(ctx.vals[1]);
+        free(ctx.hist);
+        return -1;
+    }
+
+    for (ctx.shift = 0; ctx.shift < key_size * 8; ctx.shift += mumule_radix_bits) {
+        _mule_parallel(mule, blocks, _mule_radix_hist_kernel, &ctx);
+        if (!_mule_radix_offsets(&ctx, blocks)) continue;
+        _mule_parallel(mule, blocks, _mule_radix_scatter_kernel, &ctx);
+        ctx.src ^= 1;
+    }
+
+    /* an odd number of scatter passes leaves the result in the temporary */
+    if (ctx.src) {
+        memcpy(keys, ctx.keys[1], count * key_size);
+        if (vals) memcpy(vals, ctx.vals[1], count * sizeof(uint64_t));
+    }
+
+    free(ctx.keys[1]);
+    free(ctx.vals[1]);
+    free(ctx.hist);
+
+    return 0;
+}
+
+static int mule_sort_u32(mu_mule *mule, uint32_t *keys, uint64_t *vals, size_t count)
+{
+    return _mule_radix_sort(mule, keys, vals, count, sizeof(uint32_t));
+}
+
+static int mule_sort_u64(mu_mule *mule, uint64_t *keys, uint64_t *vals, size_t count)
+{
+    return _mule_radix_sort(mule, keys, vals, count, sizeof(uint64_t));
+}
+
+/*
+ * sample sort
+ */
+
+typedef struct {
+    char *base;
+    char *tmp;
+    size_t count;
+    size_t size;
+    mumule_compare_fn cmp;
+    size_t block;
+    size_t nbuckets;
+    char *splitters;
+    size_t *splitter_idx;
+    uint8_t *bucket;
+    size_t *hist;
+    size_t *bucket_start;
+} _mu_sample_ctx;
+
+/*
+ * index of the first splitter greater than element i, comparing (key, index)
+ * so runs of equal keys spread over the buckets their splitters fall in
+ */
+static size_t _mule_sample_bucket(_mu_sample_ctx *ctx, const void *elem, size_t i)
+{
+    size_t lo = 0, hi = ctx->nbuckets - 1;
+    while (lo < hi) {
+        size_t mid = (lo + hi) >> 1;
+        int c = ctx->cmp(elem, ctx->splitters + mid * ctx->size);
+        if (c < 0 || (c == 0 && i < ctx->splitter_idx[mid])) hi = mid;
+        else lo = mid + 1;
+    }
+    return lo;
+}
+
+static int _mule_sample_idx_cmp(const void *a, const void *b)
+{
+    size_t x = *(const size_t*)a, y = *(const size_t*)b;
+    return (x > y) - (x < y);
+}
+
+static void _mule_sample_classify_kernel(void *arg, size_t thr_idx, size_t item_idx)
+{
+    _mu_sample_ctx *ctx = (_mu_sample_ctx*)arg;
+    size_t b = item_idx - 1, begin = b * ctx->block;
+    size_t end = _mule_min(begin + ctx->block, ctx->count);
+    size_t *hist = ctx->hist + b * ctx->nbuckets;
+
+    memset(hist, 0, ctx->nbuckets * sizeof(size_t));
+    for (size_t i = begin; i < end; i++) {
+        size_t k = _mule_sample_bucket(ctx, ctx->base + i * ctx->size, i);
+        ctx->bucket[i] = (uint8_t)k;
+        hist[k]++;
+    }
+}
+
+static void _mule_sample_scatter_kernel(void *arg, size_t thr_idx, size_t item_idx)
+{
+    _mu_sample_ctx *ctx = (_mu_sample_ctx*)arg;
+    size_t b = item_idx - 1, begin = b * ctx->block;
+    size_t end = _mule_min(begin + ctx->block, ctx->count);
+    size_t *off = ctx->hist + b * ctx->nbuckets;
+
+    for (size_t i = begin; i < end; i++) {
+        size_t j = off[ctx->bucket[i]]++;
+        memcpy(ctx->tmp + j * ctx->size, ctx->base + i * ctx->size, ctx->size);
+    }
+}
+
+static void _mule_sample_sort_kernel(void *arg, size_t thr_idx, size_t item_idx)
+{
+    _mu_sample_ctx *ctx = (_mu_sample_ctx*)arg;
+    size_t k = item_idx - 1;
+    size_t begin = ctx->bucket_start[k], end = ctx->bucket_start[k + 1];
+
+    qsort(ctx->tmp + begin * ctx->size, end - begin, ctx->size, ctx->cmp);
+    memcpy(ctx->base + begin * ctx->size, ctx->tmp + begin * ctx->size,
+        (end - begin) * ctx->size);
+}
+
+static int mule_sort(mu_mule *mule, void *base, size_t count, size_t size,
+    mumule_compare_fn cmp)
+{
+    _mu_sample_ctx ctx;
+    size_t blocks, nsamples, stride, idx_off, offset = 0;
+    uint64_t seed = 0x9e3779b97f4a7c15ull ^ count;
+    size_t *run;
+    char *samples;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.base = (char*)base;
+    ctx.count = count;
+    ctx.size = size;
+    ctx.cmp = cmp;
+    ctx.nbuckets = _mule_min(_mule_algo_threads(mule) * mumule_chunks_per_thread,
+        mumule_sample_max_buckets);
+    ctx.nbuckets = _mule_min(ctx.nbuckets, count / mumule_sort_min_block);
+
+    if (ctx.nbuckets < 2) {
+        qsort(base, count, size, cmp);
+        return 0;
+    }
+
+    ctx.block = _mule_algo_grain(mule, count, 0);
+    if (ctx.block < mumule_sort_min_block) ctx.block = mumule_sort_min_block;
+    blocks = _mule_algo_chunks(count, ctx.block);
+    nsamples = ctx.nbuckets * mumule_sample_oversample;
+    /* each sample is the element followed by its index, 16-byte aligned */
+    idx_off = (size + 15) & ~(size_t)15;
+    stride = idx_off + 16;
+
+    samples = (char*)malloc(nsamples * stride);
+    run = (size_t*)malloc(nsamples * sizeof(size_t));
+    ctx.splitters = (char*)malloc((ctx.nbuckets - 1) * size);
+    ctx.splitter_idx = (size_t*)malloc((ctx.nbuckets - 1) * sizeof(size_t));
+    ctx.tmp = (char*)malloc(count * size);
+    ctx.bucket = (uint8_t*)malloc(count);
+    ctx.hist = (size_t*)malloc(blocks * ctx.nbuckets * sizeof(size_t));
+    ctx.bucket_start = (size_t*)malloc((ctx.nbuckets + 1) * sizeof(size_t));
+    if (!samples || !run || !ctx.splitters || !ctx.splitter_idx || !ctx.tmp || !ctx.bucket ||
+        !ctx.hist || !ctx.bucket_start) {
+        free(samples);
+        free(run);
+        free(ctx.splitters);
+        free(ctx.splitter_idx);
+        free(ctx.tmp);
+        free(ctx.bucket);
+        free(ctx.hist);
+        free(ctx.bucket_start);
+        return -1;
+    }
+
+    /*
+     * pick random samples, sort them by key then index and take every
+     * oversample'th as a splitter. qsort only sees the key, so the indices
+     * within each run of equal keys are sorted separately.
+     */
+    for (size_t i = 0; i < nsamples; i++) {
+        uint64_t z = (seed += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        size_t idx = (size_t)((z ^ (z >> 31)) % count);
+        memcpy(samples + i * stride, ctx.base + idx * size, size);
+        memcpy(samples + i * stride + idx_off, &idx, sizeof(size_t));
+    }
+    qsort(samples, nsamples, stride, cmp);
+    for (size_t i = 0, j; i < nsamples; i = j) {
+        for (j = i + 1; j < nsamples && !cmp(samples + i * stride, samples + j * stride); j++);
+        if (j - i < 2) continue;
+        for (size_t r = i; r < j; r++) {
+            memcpy(&run[r - i], samples + r * stride + idx_off, sizeof(size_t));
+        }
+        qsort(run, j - i, sizeof(size_t), _mule_sample_idx_cmp);
+        for (size_t r = i; r < j; r++) {
+            memcpy(samples + r * stride + idx_off, &run[r - i], sizeof(size_t));
+        }
+    }
+    for (size_t k = 1; k < ctx.nbuckets; k++) {
+        const char *sample = samples + (k * mumule_sample_oversample) * stride;
+        memcpy(ctx.splitters + (k - 1) * size, sample, size);
+        memcpy(&ctx.splitter_idx[k - 1], sample + idx_off, sizeof(size_t));
+    }
+    free(samples);
+    free(run);
+
+    /* classify, compute stable offsets by bucket then block, and scatter */
+    _mule_parallel(mule, blocks, _mule_sample_classify_kernel, &ctx);
+    for (size_t k = 0; k < ctx.nbuckets; k++) {
+        ctx.bucket_start[k] = offset;
+        for (size_t b = 0; b < blocks; b++) {
+            size_t n = ctx.hist[b * ctx.nbuckets + k];
+            ctx.hist[b * ctx.nbuckets + k] = offset;
+            offset += n;
+        }
+    }
+    ctx.bucket_start[ctx.nbuckets] = offset;
+    _mule_parallel(mule, blocks, _mule_sample_scatter_kernel, &ctx);
+
+    /* sort buckets independently and copy them back into place */
+    _mule_parallel(mule, ctx.nbuckets, _mule_sample_sort_kernel, &ctx);
+
+    free(ctx.splitters);
+    free(ctx.splitter_idx);
+    free(ctx.tmp);
+    free(ctx.bucket);
+    free(ctx.hist);
+    free(ctx.bucket_start);
+
+    return 0;
+}
+
+/*
+ * compaction and partition
+ */
+
+typedef struct {
+    char *out;
+    const char *in;
+    size_t count;
+    size_t size;
+    mumule_predicate_fn pred;
+    void *userdata;
+    int mode;
+    size_t block;
+    uint64_t *bits;
+    size_t *offsets;
+    size_t total;
+} _mu_compact_ctx;
+
+enum { _mule_compact_elems, _mule_compact_indices, _mule_compact_partition };
+
+static void _mule_compact_flag_kernel(void *arg, size_t thr_idx, size_t item_idx)
+{
+    _mu_compact_ctx *ctx = (_mu_compact_ctx*)arg;
+    size_t b = item_idx - 1, begin = b * ctx->block;
+    size_t end = _mule_min(begin + ctx->block, ctx->count);
+    size_t n = 0;
+
+    for (size_t w = begin; w < end; w += 64) {
+        uint64_t word = 0;
+        for (size_t i = w; i < _mule_min(w + 64, end); i++) {
+            uint64_t flag = ctx->pred(ctx->userdata, thr_idx, i) != 0;
+            word |= flag << (i - w);
+            n += flag;
+        }
+        ctx->bits[w >> 6] = word;
+    }
+    ctx->offsets[b] = n;
+}
+
+static void _mule_compact_scatter_kernel(void *arg, size_t thr_idx, size_t item_idx)
+{
+    _mu_compact_ctx *ctx = (_mu_compact_ctx*)arg;
+    size_t b = item_idx - 1, begin = b * ctx->block;
+    size_t end = _mule_min(begin + ctx->block, ctx->count);
+    size_t j = ctx->offsets[b];
+    size_t k = ctx->total + (begin - j);
+
+    for (size_t i = begin; i < end; i++) {
+        int flag = (ctx->bits[i >> 6] >> (i & 63)) & 1;
+        switch (ctx->mode) {
+        case _mule_compact_indices:
+            if (flag) ((size_t*)ctx->out)[j++] = i;
+            break;
+        case _mule_compact_elems:
+            if (flag) memcpy(ctx->out + (j++) * ctx->size, ctx->in + i * ctx->size, ctx->size);
+            break;
+        case _mule_compact_partition: {
+            size_t o = flag ? j++ : k++;
+            memcpy(ctx->out + o * ctx->size, ctx->in + i * ctx->size, ctx->size);
+            break;
+        }
+        }
+    }
+}
+
+static size_t _mule_compact(mu_mule *mule, void *out, const void *in, size_t count,
+    size_t size, mumule_predicate_fn pred, void *userdata, int mode)
+{
+    _mu_compact_ctx ctx = { (char*)out, (const char*)in, count, size, pred, userdata, mode };
+    size_t blocks;
+
+    if (!count) return 0;
+
+    /* blocks are whole bitmap words so workers never share a word */
+    ctx.block = _mule_round_up(_mule_algo_grain(mule, count, 0), 64);
+    if (ctx.block < mumule_compact_min_block) ctx.block = mumule_compact_min_block;
+    blocks = _mule_algo_chunks(count, ctx.block);
+
+    ctx.bits = (uint64_t*)malloc(((count + 63) >> 6) * sizeof(uint64_t));
+    ctx.offsets = (size_t*)malloc(blocks * sizeof(size_t));
+    if (!ctx.bits || !ctx.offsets) {
+        free(ctx.bits);
+        free(ctx.offsets);
+        return (size_t)-1;
+    }
+
+    _mule_parallel(mule, blocks, _mule_compact_flag_kernel, &ctx);
+    for (size_t b = 0; b < blocks; b++) {
+        size_t n = ctx.offsets[b];
+        ctx.offsets[b] = ctx.total;
+        ctx.total += n;
+    }
+    _mule_parallel(mule, blocks, _mule_compact_scatter_kernel, &ctx);
+
+    free(ctx.bits);
+    free(ctx.offsets);
+
+    return ctx.total;
+}
+
+static size_t mule_compact(mu_mule *mule, void *out, const void *in, size_t count,
+    size_t size, mumule_predicate_fn pred, void *userdata)
+{
+    return _mule_compact(mule, out, in, count, size, pred, userdata, _mule_compact_elems);
+}
+
+static size_t mule_compact_idx(mu_mule *mule, size_t *out, size_t count,
+    mumule_predicate_fn pred, void *userdata)
+{
+    return _mule_compact(mule, out, NULL, count, 0, pred, userdata, _mule_compact_indices);
+}
+
+static size_t mule_partition(mu_mule *mule, void *out, const void *in, size_t count,
+    size_t size, mumule_predicate_fn pred, void *userdata)
+{
+    return _mule_compact(mule, out, in, count, size, pred, userdata, _mule_compact_partition);
+}
+
+/*
+ * bulk memory
+ */
+
+typedef struct {
+    char *dst;
+    const char *src;
+    int c;
+    size_t n;
+    uintptr_t start;
+    size_t chunk;
+    size_t chunks;
+    size_t nsets;
+    int nontemporal;
+    _Atomic(size_t) *claimed;
+} _mu_mem_ctx;
+
+static void _mule_stream_set(char *dst, int c, size_t n)
+{
+#if defined(__SSE2__)
+    size_t head = (16 - ((uintptr_t)dst & 15)) & 15;
+    if (n >= head + 16) {
+        __m128i v = _mm_set1_epi8((char)c);
+        memset(dst, c, head);
+        dst += head; n -= head;
+        for (; n >= 16; dst += 16, n -= 16) _mm_stream_si128((__m128i*)dst, v);
+    }
+#endif
+    memset(dst, c, n);
+}
+
+static void _mule_stream_copy(char *dst, const char *src, size_t n)
+{
+#if defined(__SSE2__)
+    size_t head = (16 - ((uintptr_t)dst & 15)) & 15;
+    if (n >= head + 16) {
+        memcpy(dst, src, head);
+        dst += head; src += head; n -= head;
+        for (; n >= 16; dst += 16, src += 16, n -= 16) {
+            _mm_stream_si128((__m128i*)dst, _mm_loadu_si128((const __m128i*)src));
+        }
+    }
+#endif
+    memcpy(dst, src, n);
+}
+
+static void _mule_mem_chunk(_mu_mem_ctx *ctx, size_t k)
+{
+    uintptr_t base = (uintptr_t)ctx->dst, end = base + ctx->n;
+    uintptr_t lo = ctx->start + k * ctx->chunk, hi = lo + ctx->chunk;
+    size_t off, len;
+
+    if (lo < base) lo = base;
+    if (hi > end) hi = end;
+    if (lo >= hi) return;
+    off = lo - base;
+    len = hi - lo;
+
+    if (ctx->src) {
+        if (ctx->nontemporal) _mule_stream_copy(ctx->dst + off, ctx->src + off, len);
+        else memcpy(ctx->dst + off, ctx->src + off, len);
+    } else {
+        if (ctx->nontemporal) _mule_stream_set(ctx->dst + off, ctx->c, len);
+        else memset(ctx->dst + off, ctx->c, len);
+    }
+}
+
+static void _mule_mem_kernel(void *arg, size_t thr_idx, size_t item_idx)
+{
+    _mu_mem_ctx *ctx = (_mu_mem_ctx*)arg;
+    size_t set = thr_idx % ctx->nsets;
+
+    if (!ctx->claimed) {
+        _mule_mem_chunk(ctx, item_idx - 1);
+    } else {
+        /*
+         * thread affine: take the chunk set owned by this worker, or the
+         * first unclaimed set if another item on this worker already did.
+         */
+        size_t expected = 0;
+        if (!atomic_compare_exchange_strong(&ctx->claimed[set], &expected, 1)) {
+            for (set = 0; set < ctx->nsets; set++) {
+                expected = 0;
+                if (atomic_compare_exchange_strong(&ctx->claimed[set], &expected, 1)) break;
+            }
+        }
+        for (size_t k = set; k < ctx->chunks; k += ctx->nsets) {
+            _mule_mem_chunk(ctx, k);
+        }
+    }
+
+#if defined(__SSE2__)
+    if (ctx->nontemporal) _mm_sfence();
+#endif
+}
+
+static void _mule_mem(mu_mule *mule, void *dst, const void *src, int c, size_t n, int flags)
+{
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    _mu_mem_ctx ctx;
+
+    if (n < mumule_mem_min_parallel) {
+        if (src) memcpy(dst, src, n); else memset(dst, c, n);
+        return;
+    }
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.dst = (char*)dst;
+    ctx.src = (const char*)src;
+    ctx.c = c;
+    ctx.n = n;
+    ctx.nontemporal = (flags & mumule_mem_nontemporal) ||
+        (!(flags & mumule_mem_temporal) && n >= mumule_mem_nontemporal_threshold);
+
+    /* page-aligned chunks so that no page is split between workers */
+    ctx.start = (uintptr_t)dst & ~(uintptr_t)(page_size - 1);
+    ctx.chunk = _mule_algo_grain(mule, n + ((uintptr_t)dst - ctx.start), 0);
+    ctx.chunk = _mule_round_up(ctx.chunk, page_size);
+    if (ctx.chunk < mumule_mem_min_chunk) ctx.chunk = mumule_mem_min_chunk;
+    ctx.chunks = _mule_algo_chunks((uintptr_t)dst + n - ctx.start, ctx.chunk);
+
+    if (flags & mumule_mem_thread_affine) {
+        ctx.nsets = _mule_min(_mule_algo_threads(mule), ctx.chunks);
+        ctx.claimed = (_Atomic(size_t)*)calloc(ctx.nsets, sizeof(_Atomic(size_t)));
+    }
+
+    if (ctx.claimed) {
+        _mule_parallel(mule, ctx.nsets, _mule_mem_kernel, &ctx);
+        free(ctx.claimed);
+    } else {
+        ctx.nsets = 1;
+        _mule_parallel(mule, ctx.chunks, _mule_mem_kernel, &ctx);
+    }
+}
+
+static void mule_memcpy(mu_mule *mule, void *dst, const void *src, size_t n, int flags)
+{
+    _mule_mem(mule, dst, src, 0, n, flags);
+}
+
+static void mule_memset(mu_mule *mule, void *dst, int c, size_t n, int flags)
+{
+    _mule_mem(mule, dst, NULL, c, n, flags);
+}
+
+static void mule_first_touch(mu_mule *mule, void *dst, size_t n)
+{
+    _mule_mem(mule, dst, NULL, 0, n, mumule_mem_thread_affine);
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,421 @@
+/*
+ * Copyright 2021, Michael Clark <micheljclark@mac.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#pragma once
+
+#include "mualgo.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * mukernel built-in range kernels:
+ *
+ * - `mule_axpy_f32(mule, a, x, y, count)` for y = a * x + y
+ * - `mule_dot_f32(mule, x, y, count)` for the dot product of x and y
+ * - `mule_minmax_f32(mule, x, count, &min, &max)` for the range of x
+ * - `mule_histogram_u8(mule, data, count, hist)` to count byte values
+ * - `mule_count_byte(mule, data, count, c)` to count occurrences of c
+ * - `mule_find_byte(mule, data, count, c)` for the first index of c
+ * - `mule_adler32(mule, adler, data, count)` for a zlib adler-32 checksum
+ *
+ * each operation has a `mule_range_*` function that works on one range
+ * and is compiled with `MULE_TARGET_CLONES` so it runs with AVX-512, AVX2
+ * or baseline code selected for the cpu at load time. the range functions
+ * can be called from user kernels. the `mule_*` drivers run them on the
+ * pool, using `mule_reduce` for reductions, and `mule_kernel_axpy_f32`
+ * plugs into `mule_init` and `mule_submit` directly:
+ *
+ *     mu_axpy_f32 args = { 2.0f, x, y, count, 1 << 16 };
+ *     mule_init(&mule, 8, mule_kernel_axpy_f32, &args);
+ *     mule_submit(&mule, mule_axpy_f32_items(&args));
+ *
+ * the reductions use a fixed grain and combine per-chunk results in a
+ * fixed order, so the float results do not depend on the number of threads.
+ */
+
+struct mu_axpy_f32;
+typedef struct mu_axpy_f32 mu_axpy_f32;
+
+struct mu_axpy_f32
+{
+    float            a;
+    const float*     x;
+    float*           y;
+    size_t           count;
+    size_t           grain;
+};
+
+static void mule_kernel_axpy_f32(void *arg, size_t thr_idx, size_t item_idx);
+static size_t mule_axpy_f32_items(const mu_axpy_f32 *args);
+
+static void mule_axpy_f32(mu_mule *mule, float a, const float *x, float *y, size_t count);
+static float mule_dot_f32(mu_mule *mule, const float *x, const float *y, size_t count);
+static void mule_minmax_f32(mu_mule *mule, const float *x, size_t count,
+    float *min, float *max);
+static void mule_histogram_u8(mu_mule *mule, const uint8_t *data, size_t count,
+    uint64_t hist[256]);
+static size_t mule_count_byte(mu_mule *mule, const uint8_t *data, size_t count, uint8_t c);
+static size_t mule_find_byte(mu_mule *mule, const uint8_t *data, size_t count, uint8_t c);
+static uint32_t mule_adler32(mu_mule *mule, uint32_t adler, const uint8_t *data, size_t count);
+
+enum {
+    mumule_kernel_min_grain = 1 << 16,
+    mumule_adler_base = 65521,
+    mumule_adler_nmax = 5552,
+};
+
+/*
+ * range kernels
+ */
+
+MULE_TARGET_CLONES
+static void mule_range_axpy_f32(float a, const float *x, float *y, size_t n)
+{
+    for (size_t i = 0; i < n; i++) y[i] = a * x[i] + y[i];
+}
+
+MULE_TARGET_CLONES
+static float mule_range_dot_f32(const float *x, const float *y, size_t n)
+{
+    float acc[16] = { 0 }, sum = 0;
+    size_t i = 0;
+
+    /* independent lanes let the compiler vectorize without reassociating */
+    for (; i + 16 <= n; i += 16) {
+        for (size_t j = 0; j < 16; j++) acc[j] += x[i + j] * y[i + j];
+    }
+    for (; i < n; i++) acc[i & 15] += x[i] * y[i];
+    for (size_t j = 0; j < 16; j++) sum += acc[j];
+
+    return sum;
+}
+
+MULE_TARGET_CLONES
+static void mule_range_minmax_f32(const float *x, size_t n, float *min, float *max)
+{
+    float lo = *min, hi = *max;
+    for (size_t i = 0; i < n; i++) {
+        lo = x[i] < lo ? x[i] : lo;
+        hi = x[i] > hi ? x[i] : hi;
+    }
+    *min = lo;
+    *max = hi;
+}
+
+MULE_TARGET_CLONES
+static void mule_range_histogram_u8(const uint8_t *data, size_t n, uint64_t hist[256])
+{
+    /* four sub-histograms avoid store-to-load stalls on repeated bytes */
+    uint32_t h[4][256];
+
+    while (n) {
+        size_t len = n < ((size_t)1 << 30) ? n : ((size_t)1 << 30), i = 0;
+        memset(h, 0, sizeof(h));
+        for (; i + 4 <= len; i += 4) {
+            h[0][data[i]]++;
+            h[1][data[i + 1]]++;
+            h[2][data[i + 2]]++;
+            h[3][data[i + 3]]++;
+        }
+        for (; i < len; i++) h[0][data[i]]++;
+        for (size_t k = 0; k < 256; k++) {
+            hist[k] += (uint64_t)h[0][k] + h[1][k] + h[2][k] + h[3][k];
+        }
+        data += len;
+        n -= len;
+    }
+}
+
+MULE_TARGET_CLONES
+static size_t mule_range_count_byte(const uint8_t *data, size_t n, uint8_t c)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) count += data[i] == c;
+    return count;
+}
+
+static size_t mule_range_find_byte(const uint8_t *data, size_t n, uint8_t c)
+{
+    /* libc memchr is already vectorized and dispatched at runtime */
+    const uint8_t *p = (const uint8_t*)memchr(data, c, n);
+    return p ? (size_t)(p - data) : n;
+}
+
+/*
+ * adler-32 in blocks of at most NMAX bytes where the byte-position weighted
+ * sum cannot overflow 32 bits, written as sums that vectorize:
+ * a' = a + sum(d[i]) and b' = b + len * a + sum((len - i) * d[i]).
+ */
+MULE_TARGET_CLONES
+static uint32_t mule_range_adler32(uint32_t adler, const uint8_t *data, size_t n)
+{
+    uint32_t a = adler & 0xffff, b = adler >> 16;
+
+    while (n) {
+        uint32_t len = (uint32_t)(n < mumule_adler_nmax ? n : mumule_adler_nmax);
+        uint32_t s1 = 0, s2 = 0;
+        for (uint32_t i = 0; i < len; i++) {
+            s1 += data[i];
+            s2 += (len - i) * data[i];
+        }
+        b = (b + len * a + s2 % mumule_adler_base) % mumule_adler_base;
+        a = (a + s1) % mumule_adler_base;
+        data += len;
+        n -= len;
+    }
+
+    return a | (b << 16);
+}
+
+/* zlib adler32_combine: checksum of A|B from those of A and B */
+static uint32_t mule_adler32_combine(uint32_t adler1, uint32_t adler2, size_t len2)
+{
+    const uint32_t base = mumule_adler_base;
+    uint32_t rem = (uint32_t)(len2 % base);
+    uint32_t sum1 = adler1 & 0xffff;
+    uint32_t sum2 = (uint32_t)(((uint64_t)rem * sum1) % base);
+
+    sum1 += (adler2 & 0xffff) + base - 1;
+    sum2 += ((adler1 >> 16) & 0xffff) + ((adler2 >> 16) & 0xffff) + base - rem;
+    if (sum1 >= base) sum1 -= base;
+    if (sum1 >= base) sum1 -= base;
+    if (sum2 >= (base << 1)) sum2 -= (base << 1);
+    if (sum2 >= base) sum2 -= base;
+
+    return sum1 | (sum2 << 16);
+}
+
+/*
+ * mukernel implementation
+ */
+
+static size_t _mule_kernel_grain(mu_mule *mule, size_t count)
+{
+    size_t grain = _mule_algo_grain(mule, count, 0);
+    return grain < mumule_kernel_min_grain ? mumule_kernel_min_grain : grain;
+}
+
+static void mule_kernel_axpy_f32(void *arg, size_t thr_idx, size_t item_idx)
+{
+    mu_axpy_f32 *args = (mu_axpy_f32*)arg;
+    size_t begin = (item_idx - 1) * args->grain;
+    size_t n = _mule_min(args->grain, args->count - begin);
+
+    mule_range_axpy_f32(args->a, args->x + begin, args->y + begin, n);
+}
+
+static size_t mule_axpy_f32_items(const mu_axpy_f32 *args)
+{
+    return _mule_algo_chunks(args->count, args->grain);
+}
+
+static void mule_axpy_f32(mu_mule *mule, float a, const float *x, float *y, size_t count)
+{
+    mu_axpy_f32 args = { a, x, y, count, _mule_kernel_grain(mule, count) };
+    _mule_parallel(mule, mule_axpy_f32_items(&args), mule_kernel_axpy_f32, &args);
+}
+
+typedef struct {
+    const float *x;
+    const float *y;
+    const uint8_t *data;
+    uint8_t c;
+} _mu_kernel_args;
+
+static void _mule_reduce_kernel_op(mu_mule *mule, mu_reduce_op *op, size_t elem_size,
+    const void *identity, size_t count, _mu_kernel_args *args)
+{
+    op->elem_size = elem_size;
+    op->identity = identity;
+    op->count = count;
+    /* a pool-sized grain would move the chunk boundaries with the threads */
+    op->grain = mumule_kernel_min_grain;
+    op->accumulate_item = NULL;
+    op->userdata = args;
+    op->flags = mumule_reduce_deterministic;
+}
+
+static void _mule_dot_acc(void *arg, void *acc, size_t begin, size_t end)
+{
+    _mu_kernel_args *args = (_mu_kernel_args*)arg;
+    *(double*)acc += mule_range_dot_f32(args->x + begin, args->y + begin, end - begin);
+}
+
+static void _mule_add_f64(void *arg, void *acc, const void *rhs)
+{
+    *(double*)acc += *(const double*)rhs;
+}
+
+static float mule_dot_f32(mu_mule *mule, const float *x, const float *y, size_t count)
+{
+    _mu_kernel_args args = { x, y };
+    double zero = 0, sum;
+    mu_reduce_op op;
+
+    _mule_reduce_kernel_op(mule, &op, sizeof(double), &zero, count, &args);
+    op.accumulate = _mule_dot_acc;
+    op.combine = _mule_add_f64;
+    assert(!mule_reduce(mule, &op, &sum));
+
+    return (float)sum;
+}
+
+static void _mule_minmax_acc(void *arg, void *acc, size_t begin, size_t end)
+{
+    _mu_kernel_args *args = (_mu_kernel_args*)arg;
+    float *mm = (float*)acc;
+    mule_range_minmax_f32(args->x + begin, end - begin, &mm[0], &mm[1]);
+}
+
+static void _mule_minmax_combine(void *arg, void *acc, const void *rhs)
+{
+    float *mm = (float*)acc;
+    const float *r = (const float*)rhs;
+    if (r[0] < mm[0]) mm[0] = r[0];
+    if (r[1] > mm[1]) mm[1] = r[1];
+}
+
+static void mule_minmax_f32(mu_mule *mule, const float *x, size_t count,
+    float *min, float *max)
+{
+    _mu_kernel_args args = { x };
+    float identity[2] = { __builtin_inff(), -__builtin_inff() }, mm[2];
+    mu_reduce_op op;
+
+    _mule_reduce_kernel_op(mule, &op, sizeof(mm), identity, count, &args);
+    op.accumulate = _mule_minmax_acc;
+    op.combine = _mule_minmax_combine;
+    assert(!mule_reduce(mule, &op, mm));
+
+    *min = mm[0];
+    *max = mm[1];
+}
+
+static void _mule_histogram_acc(void *arg, void *acc, size_t begin, size_t end)
+{
+    _mu_kernel_args *args = (_mu_kernel_args*)arg;
+    mule_range_histogram_u8(args->data + begin, end - begin, (uint64_t*)acc);
+}
+
+static void _mule_histogram_combine(void *arg, void *acc, const void *rhs)
+{
+    for (size_t k = 0; k < 256; k++) ((uint64_t*)acc)[k] += ((const uint64_t*)rhs)[k];
+}
+
+static void mule_histogram_u8(mu_mule *mule, const uint8_t *data, size_t count,
+    uint64_t hist[256])
+{
+    _mu_kernel_args args = { NULL, NULL, data };
+    uint64_t zero[256] = { 0 };
+    mu_reduce_op op;
+
+    _mule_reduce_kernel_op(mule, &op, sizeof(zero), zero, count, &args);
+    op.accumulate = _mule_histogram_acc;
+    op.combine = _mule_histogram_combine;
+    assert(!mule_reduce(mule, &op, hist));
+}
+
+static void _mule_count_byte_acc(void *arg, void *acc, size_t begin, size_t end)
+{
+    _mu_kernel_args *args = (_mu_kernel_args*)arg;
+    *(size_t*)acc += mule_range_count_byte(args->data + begin, end - begin, args->c);
+}
+
+static void _mule_add_size(void *arg, void *acc, const void *rhs)
+{
+    *(size_t*)acc += *(const size_t*)rhs;
+}
+
+static size_t mule_count_byte(mu_mule *mule, const uint8_t *data, size_t count, uint8_t c)
+{
+    _mu_kernel_args args = { NULL, NULL, data, c };
+    size_t zero = 0, n;
+    mu_reduce_op op;
+
+    _mule_reduce_kernel_op(mule, &op, sizeof(size_t), &zero, count, &args);
+    op.accumulate = _mule_count_byte_acc;
+    op.combine = _mule_add_size;
+    assert(!mule_reduce(mule, &op, &n));
+
+    return n;
+}
+
+static void _mule_find_byte_acc(void *arg, void *acc, size_t begin, size_t end)
+{
+    _mu_kernel_args *args = (_mu_kernel_args*)arg;
+    size_t i = begin + mule_range_find_byte(args->data + begin, end - begin, args->c);
+    if (i < end && i < *(size_t*)acc) *(size_t*)acc = i;
+}
+
+static void _mule_min_size(void *arg, void *acc, const void *rhs)
+{
+    if (*(const size_t*)rhs < *(size_t*)acc) *(size_t*)acc = *(const size_t*)rhs;
+}
+
+/* returns count if `c` does not occur */
+static size_t mule_find_byte(mu_mule *mule, const uint8_t *data, size_t count, uint8_t c)
+{
+    _mu_kernel_args args = { NULL, NULL, data, c };
+    size_t none = count, idx;
+    mu_reduce_op op;
+
+    _mule_reduce_kernel_op(mule, &op, sizeof(size_t), &none, count, &args);
+    op.accumulate = _mule_find_byte_acc;
+    op.combine = _mule_min_size;
+    assert(!mule_reduce(mule, &op, &idx));
+
+    return idx;
+}
+
+typedef struct { uint32_t adler; size_t len; } _mu_adler;
+
+static void _mule_adler32_acc(void *arg, void *acc, size_t begin, size_t end)
+{
+    _mu_kernel_args *args = (_mu_kernel_args*)arg;
+    _mu_adler *a = (_mu_adler*)acc;
+    a->adler = mule_range_adler32(a->adler, args->data + begin, end - begin);
+    a->len += end - begin;
+}
+
+static void _mule_adler32_combine(void *arg, void *acc, const void *rhs)
+{
+    _mu_adler *a = (_mu_adler*)acc;
+    const _mu_adler *b = (const _mu_adler*)rhs;
+    a->adler = mule_adler32_combine(a->adler, b->adler, b->len);
+    a->len += b->len;
+}
+
+/* chunks combine in order, so the checksum matches a serial adler-32 */
+static uint32_t mule_adler32(mu_mule *mule, uint32_t adler, const uint8_t *data, size_t count)
+{
+    _mu_kernel_args args = { NULL, NULL, data };
+    _mu_adler identity = { 1, 0 }, sum;
+    mu_reduce_op op;
+
+    _mule_reduce_kernel_op(mule, &op, sizeof(_mu_adler), &identity, count, &args);
+    op.accumulate = _mule_adler32_acc;
+    op.combine = _mule_adler32_combine;
+    assert(!mule_reduce(mule, &op, &sum));
+
+    return mule_adler32_combine(adler, sum.adler, count);
+}
+
+#ifdef __cplusplus
+}
+#endif
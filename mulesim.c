@@ -0,0 +1,299 @@
+/*
+ * mulesim - replay a recording through a model of the mumule scheduler
+ *
+ * usage: mulesim [-t threads] [-g grains] [-p policies] [-c claim-ns]
+ *                [-w wake-ns] <recording>
+ *
+ * reads a recording written by mule_record_write and replays its submits,
+ * syncs and item durations with each combination of the comma-separated
+ * thread counts, grain sizes and policies:
+ *
+ * - dynamic: one item per claim, as mumule does today
+ * - chunked: `grain` items per claim
+ * - guided: max(grain, remaining / (2 * threads)) items per claim
+ * - static: each submit split into one contiguous block per thread
+ *
+ * claims are serialized on the shared counter and each costs claim-ns.
+ * workers are parked when an epoch opens, and a worker that runs out of
+ * items parks; either costs wake-ns to resume when the next submit arrives.
+ * host think time between a sync and the next submit is taken from the
+ * recording. speedup is relative to running every item and think time
+ * serially.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+enum { policy_dynamic, policy_chunked, policy_guided, policy_static };
+
+static const char *policy_names[] = { "dynamic", "chunked", "guided", "static" };
+
+typedef struct { uint64_t time_ns; size_t count; } batch;
+
+typedef struct {
+	size_t first_batch, num_batches;
+	uint64_t submit_ns, sync_ns;
+} epoch;
+
+typedef struct {
+	size_t threads;
+	uint64_t *items;
+	size_t num_items;
+	batch *batches;
+	size_t num_batches;
+	epoch *epochs;
+	size_t num_epochs;
+} recording;
+
+typedef struct {
+	uint64_t makespan_ns;
+	uint64_t serial_ns;
+	double imbalance;
+	double efficiency;
+} result;
+
+static int load(recording *r, const char *path)
+{
+	FILE *f = fopen(path, "r");
+	char line[128];
+	size_t max_batches = 0, max_epochs = 0, open_batch = 0;
+	int version = 0;
+
+	memset(r, 0, sizeof(*r));
+	if (!f) return -1;
+	if (!fgets(line, sizeof(line), f) || sscanf(line, "mumule-record %d", &version) != 1 ||
+		version != 1) {
+		fclose(f);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		unsigned long long t, n;
+		if (sscanf(line, "threads %llu", &n) == 1) {
+			r->threads = n;
+		} else if (sscanf(line, "submit %llu %llu", &t, &n) == 2) {
+			if (r->num_batches == max_batches) {
+				max_batches = max_batches ? max_batches * 2 : 64;
+				r->batches = realloc(r->batches, max_batches * sizeof(batch));
+			}
+			r->batches[r->num_batches++] = (batch) { t, n };
+		} else if (sscanf(line, "sync %llu", &t) == 1) {
+			if (open_batch == r->num_batches) continue;
+			if (r->num_epochs == max_epochs) {
+				max_epochs = max_epochs ? max_epochs * 2 : 64;
+				r->epochs = realloc(r->epochs, max_epochs * sizeof(epoch));
+			}
+			r->epochs[r->num_epochs++] = (epoch) {
+				open_batch, r->num_batches - open_batch,
+				r->batches[open_batch].time_ns, t
+			};
+			open_batch = r->num_batches;
+		} else if (sscanf(line, "items %llu", &n) == 1) {
+			r->num_items = n;
+			r->items = calloc(n ? n : 1, sizeof(uint64_t));
+			for (size_t i = 0; i < n && fgets(line, sizeof(line), f); i++) {
+				r->items[i] = strtoull(line, NULL, 10);
+			}
+			break;
+		}
+	}
+	fclose(f);
+	return r->items && r->num_epochs ? 0 : -1;
+}
+
+/* when a worker can start on items available at `avail_ns`, waking it if idle */
+static uint64_t ready(uint64_t worker_free, uint64_t avail_ns, uint64_t wake_ns)
+{
+	return worker_free <= avail_ns ? avail_ns + wake_ns : worker_free;
+}
+
+/* a claim on the shared counter, returning when it lands */
+static uint64_t claim(uint64_t *counter_free, uint64_t worker_free,
+	uint64_t avail_ns, uint64_t claim_ns, uint64_t wake_ns)
+{
+	uint64_t t = ready(worker_free, avail_ns, wake_ns);
+	if (t < *counter_free) t = *counter_free;
+	*counter_free = t + claim_ns;
+	return *counter_free;
+}
+
+static void simulate(recording *r, result *res, int policy, size_t threads,
+	size_t grain, uint64_t claim_ns, uint64_t wake_ns)
+{
+	uint64_t *free_ns = calloc(threads, sizeof(uint64_t));
+	uint64_t *busy_ns = calloc(threads, sizeof(uint64_t));
+	uint64_t now = 0, prev_sync = 0, counter_free = 0;
+	uint64_t span_total = 0, busy_total = 0;
+	double imbalance = 0;
+	size_t item = 0, epochs = 0;
+
+	memset(res, 0, sizeof(*res));
+	for (size_t e = 0; e < r->num_epochs && item < r->num_items; e++) {
+		epoch *ep = &r->epochs[e];
+		uint64_t think = e ? ep->submit_ns - prev_sync : 0;
+		uint64_t start = now + think, end = start;
+
+		res->serial_ns += think;
+		prev_sync = ep->sync_ns;
+		for (size_t w = 0; w < threads; w++) {
+			free_ns[w] = start;
+			busy_ns[w] = 0;
+		}
+		counter_free = start;
+
+		for (size_t b = ep->first_batch; b < ep->first_batch + ep->num_batches; b++) {
+			uint64_t avail = start + r->batches[b].time_ns - ep->submit_ns;
+			size_t left = r->batches[b].count;
+			if (left > r->num_items - item) left = r->num_items - item;
+
+			if (policy == policy_static) {
+				for (size_t w = 0; w < threads && left; w++) {
+					size_t n = (left + (threads - w) - 1) / (threads - w);
+					uint64_t t = ready(free_ns[w], avail, wake_ns);
+					uint64_t work = 0;
+					for (size_t i = 0; i < n; i++) work += r->items[item + i];
+					free_ns[w] = t + claim_ns + work;
+					busy_ns[w] += work;
+					item += n;
+					left -= n;
+				}
+				continue;
+			}
+
+			while (left) {
+				size_t w = 0, n;
+				for (size_t i = 1; i < threads; i++) {
+					if (free_ns[i] < free_ns[w]) w = i;
+				}
+				switch (policy) {
+				case policy_dynamic: n = 1; break;
+				case policy_chunked: n = grain; break;
+				default: n = left / (2 * threads); if (n < grain) n = grain; break;
+				}
+				if (n > left) n = left;
+				uint64_t t = claim(&counter_free, free_ns[w], avail, claim_ns, wake_ns);
+				uint64_t work = 0;
+				for (size_t i = 0; i < n; i++) work += r->items[item + i];
+				free_ns[w] = t + work;
+				busy_ns[w] += work;
+				item += n;
+				left -= n;
+			}
+		}
+
+		uint64_t max_busy = 0, sum_busy = 0;
+		for (size_t w = 0; w < threads; w++) {
+			if (free_ns[w] > end) end = free_ns[w];
+			if (busy_ns[w] > max_busy) max_busy = busy_ns[w];
+			sum_busy += busy_ns[w];
+		}
+		if (sum_busy) imbalance += (double)max_busy * threads / sum_busy - 1.0;
+		res->serial_ns += sum_busy;
+		span_total += end - start;
+		busy_total += sum_busy;
+		now = end;
+		epochs++;
+	}
+
+	res->makespan_ns = now;
+	res->imbalance = epochs ? imbalance / epochs : 0;
+	res->efficiency = span_total ? (double)busy_total / ((double)span_total * threads) : 0;
+	free(free_ns);
+	free(busy_ns);
+}
+
+static size_t parse_list(const char *s, size_t *out, size_t max)
+{
+	size_t n = 0;
+	char *end;
+	while (*s && n < max) {
+		out[n++] = strtoul(s, &end, 10);
+		if (*end != ',') break;
+		s = end + 1;
+	}
+	return n;
+}
+
+static int parse_policies(const char *s, int *out)
+{
+	int n = 0;
+	while (*s && n < 4) {
+		size_t len = strcspn(s, ",");
+		int p;
+		for (p = 0; p < 4; p++) {
+			if (strlen(policy_names[p]) == len && !strncmp(s, policy_names[p], len)) break;
+		}
+		if (p == 4) return -1;
+		out[n++] = p;
+		s += len + (s[len] == ',');
+	}
+	return n;
+}
+
+int main(int argc, const char **argv)
+{
+	const char *path = NULL;
+	size_t threads[64] = { 1, 2, 4, 8, 16 }, grains[64] = { 1 };
+	size_t num_threads = 5, num_grains = 1;
+	int policies[4] = { policy_dynamic, policy_chunked, policy_guided, policy_static };
+	int num_policies = 4;
+	unsigned long long claim_ns = 50, wake_ns = 5000;
+	recording r;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			num_threads = parse_list(argv[++i], threads, 64);
+		} else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+			num_grains = parse_list(argv[++i], grains, 64);
+		} else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+			num_policies = parse_policies(argv[++i], policies);
+		} else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+			claim_ns = strtoull(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+			wake_ns = strtoull(argv[++i], NULL, 10);
+		} else if (argv[i][0] != '-' && !path) {
+			path = argv[i];
+		} else {
+			path = NULL;
+			break;
+		}
+	}
+	for (size_t i = 0; i < num_threads; i++) if (!threads[i]) num_threads = 0;
+	for (size_t i = 0; i < num_grains; i++) if (!grains[i]) num_grains = 0;
+	if (!path || !num_threads || !num_grains || num_policies <= 0) {
+		fprintf(stderr, "usage: %s [-t threads] [-g grains] [-p policies] "
+			"[-c claim-ns] [-w wake-ns] <recording>\n", argv[0]);
+		exit(1);
+	}
+	if (load(&r, path) < 0) {
+		fprintf(stderr, "%s: cannot read recording %s\n", argv[0], path);
+		exit(1);
+	}
+
+	uint64_t recorded = r.epochs[r.num_epochs - 1].sync_ns - r.epochs[0].submit_ns;
+	printf("# %zu items, %zu submits, %zu syncs, recorded with %zu threads in %.3f ms\n",
+		r.num_items, r.num_batches, r.num_epochs, r.threads, recorded / 1e6);
+	printf("%-8s %7s %7s %12s %8s %9s %10s\n", "policy", "threads", "grain",
+		"makespan-ms", "speedup", "imbalance", "efficiency");
+	for (int p = 0; p < num_policies; p++) {
+		/* grain only changes chunked and guided */
+		int grained = policies[p] == policy_chunked || policies[p] == policy_guided;
+		size_t ng = grained ? num_grains : 1;
+		for (size_t t = 0; t < num_threads; t++) {
+			for (size_t g = 0; g < ng; g++) {
+				result res;
+				simulate(&r, &res, policies[p], threads[t], grains[g], claim_ns, wake_ns);
+				printf("%-8s %7zu %7zu %12.3f %8.2f %9.3f %10.3f\n",
+					policy_names[policies[p]], threads[t], grained ? grains[g] : (size_t)1,
+					res.makespan_ns / 1e6,
+					res.makespan_ns ? (double)res.serial_ns / res.makespan_ns : 0,
+					res.imbalance, res.efficiency);
+			}
+		}
+	}
+
+	free(r.items);
+	free(r.batches);
+	free(r.epochs);
+}
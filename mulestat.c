@@ -0,0 +1,181 @@
+/*
+ * mulestat - live view of a pool published with mule_publish
+ *
+ * usage: mulestat [-p] [-i interval-ms] [-n count] <name>
+ *
+ * attaches read-only to /dev/shm/mule-<name> (or a path) and prints queue
+ * depth, throughput and per-worker utilization every interval. with -p
+ * it prints one snapshot in the Prometheus text exposition format.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include "mumule.h"
+
+int debug = 0;
+
+typedef struct { mu_shm_page *page; size_t size; } mapped_page;
+
+static int attach(mapped_page *m, const char *path)
+{
+	int fd;
+	mu_shm_page hdr;
+
+	if ((fd = open(path, O_RDONLY)) < 0) return -1;
+	if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+		memcmp(hdr.magic, mumule_shm_magic, sizeof(hdr.magic)) ||
+		hdr.version != mumule_shm_version) {
+		close(fd);
+		return -1;
+	}
+	m->size = sizeof(mu_shm_page) + hdr.num_threads * sizeof(mu_shm_worker);
+	m->page = (mu_shm_page*)mmap(NULL, m->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	return m->page == MAP_FAILED ? -1 : 0;
+}
+
+/* copy the page, retrying while the publisher is writing it */
+static void snapshot(mapped_page *m, mu_shm_page *out)
+{
+	uint64_t seq0, seq1;
+	do {
+		seq0 = atomic_load_explicit(&m->page->seq, __ATOMIC_ACQUIRE);
+		memcpy(out, m->page, m->size);
+		atomic_thread_fence(__ATOMIC_ACQUIRE);
+		seq1 = atomic_load_explicit(&m->page->seq, __ATOMIC_RELAXED);
+	} while ((seq0 & 1) || seq0 != seq1);
+}
+
+static void prometheus(mu_shm_page *p, const char *name)
+{
+	printf("# HELP mule_queued_total Work-items submitted.\n");
+	printf("# TYPE mule_queued_total counter\n");
+	printf("mule_queued_total{pool=\"%s\"} %llu\n", name, (unsigned long long)p->queued);
+	printf("# HELP mule_processed_total Work-items completed.\n");
+	printf("# TYPE mule_processed_total counter\n");
+	printf("mule_processed_total{pool=\"%s\"} %llu\n", name, (unsigned long long)p->processed);
+	printf("# HELP mule_queue_depth Work-items submitted and not completed.\n");
+	printf("# TYPE mule_queue_depth gauge\n");
+	printf("mule_queue_depth{pool=\"%s\"} %llu\n", name,
+		(unsigned long long)(p->queued - p->processed));
+	printf("# HELP mule_syncs_total Calls to mule_sync.\n");
+	printf("# TYPE mule_syncs_total counter\n");
+	printf("mule_syncs_total{pool=\"%s\"} %llu\n", name, (unsigned long long)p->syncs);
+
+	static const struct {
+		const char *name, *help, *type;
+		size_t offset;
+		double scale;
+	} metrics[] = {
+		{ "mule_worker_items_total", "Work-items run by the worker.", "counter",
+			offsetof(mu_shm_worker, items), 1 },
+		{ "mule_worker_busy_seconds_total", "Time in the kernel (mumule_stats_time).", "counter",
+			offsetof(mu_shm_worker, busy_ns), 1e-9 },
+		{ "mule_worker_park_seconds_total", "Time parked waiting for work.", "counter",
+			offsetof(mu_shm_worker, park_ns), 1e-9 },
+		{ "mule_worker_parks_total", "Times the worker parked.", "counter",
+			offsetof(mu_shm_worker, parks), 1 },
+		{ "mule_worker_wake_timeouts_total", "Parks ended by the revalidation timeout.", "counter",
+			offsetof(mu_shm_worker, wake_timeouts), 1 },
+		{ "mule_worker_cas_failures_total", "Claims lost to another worker.", "counter",
+			offsetof(mu_shm_worker, cas_failures), 1 },
+		{ "mule_worker_parked", "Whether the worker is parked.", "gauge",
+			offsetof(mu_shm_worker, parked), 1 },
+	};
+	for (size_t k = 0; k < sizeof(metrics) / sizeof(metrics[0]); k++) {
+		printf("# HELP %s %s\n# TYPE %s %s\n", metrics[k].name, metrics[k].help,
+			metrics[k].name, metrics[k].type);
+		for (uint32_t i = 0; i < p->num_threads; i++) {
+			uint64_t v = *(uint64_t*)((char*)&p->workers[i] + metrics[k].offset);
+			if (metrics[k].scale == 1) {
+				printf("%s{pool=\"%s\",worker=\"%u\"} %llu\n", metrics[k].name,
+					name, i, (unsigned long long)v);
+			} else {
+				printf("%s{pool=\"%s\",worker=\"%u\"} %.9f\n", metrics[k].name,
+					name, i, v * metrics[k].scale);
+			}
+		}
+	}
+}
+
+static void top(mu_shm_page *p, mu_shm_page *q, const char *name, int tty)
+{
+	double dt = (q->time_ns - p->time_ns) * 1e-9;
+	int stale = kill((pid_t)q->pid, 0) < 0 || q->time_ns == p->time_ns;
+
+	if (tty) printf("\033[H\033[2J");
+	printf("mule-%s pid %llu%s  queued %llu  processed %llu  depth %llu  "
+		"rate %.0f/s  syncs %.0f/s\n", name, (unsigned long long)q->pid,
+		stale ? " (stale)" : "", (unsigned long long)q->queued,
+		(unsigned long long)q->processed, (unsigned long long)(q->queued - q->processed),
+		dt > 0 ? (q->processed - p->processed) / dt : 0,
+		dt > 0 ? (q->syncs - p->syncs) / dt : 0);
+	printf("%6s %12s %12s %7s %9s %9s %7s\n", "worker", "items", "items/s",
+		"util%", "parks/s", "lost/s", "state");
+	for (uint32_t i = 0; i < q->num_threads; i++) {
+		mu_shm_worker *a = &p->workers[i], *b = &q->workers[i];
+		double park = dt > 0 ? (b->park_ns - a->park_ns) * 1e-9 / dt : 0;
+		double util = 100.0 * (1.0 - (park < 1 ? park : 1));
+		printf("%6u %12llu %12.0f %7.1f %9.0f %9.0f %7s\n", i,
+			(unsigned long long)b->items,
+			dt > 0 ? (b->items - a->items) / dt : 0, dt > 0 ? util : 0,
+			dt > 0 ? (b->parks - a->parks) / dt : 0,
+			dt > 0 ? (b->cas_failures - a->cas_failures) / dt : 0,
+			b->parked ? "parked" : "running");
+	}
+	fflush(stdout);
+}
+
+int main(int argc, const char **argv)
+{
+	const char *name = NULL;
+	char path[256];
+	int prom = 0;
+	long interval_ms = 1000, count = -1;
+	mapped_page m;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-p") == 0) {
+			prom = 1;
+		} else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+			interval_ms = atol(argv[++i]);
+		} else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			count = atol(argv[++i]);
+		} else if (argv[i][0] != '-' && !name) {
+			name = argv[i];
+		} else {
+			name = NULL;
+			break;
+		}
+	}
+	if (!name || interval_ms <= 0) {
+		fprintf(stderr, "usage: %s [-p] [-i interval-ms] [-n count] <name>\n", argv[0]);
+		exit(1);
+	}
+
+	mule_publish_path(path, sizeof(path), name);
+	if (attach(&m, path) < 0) {
+		fprintf(stderr, "%s: cannot attach to %s\n", argv[0], path);
+		exit(1);
+	}
+
+	mu_shm_page *prev = (mu_shm_page*)malloc(m.size), *cur = (mu_shm_page*)malloc(m.size);
+	snapshot(&m, cur);
+	if (prom) {
+		prometheus(cur, name);
+	} else {
+		int tty = isatty(1);
+		for (long n = 0; count < 0 || n < count; n++) {
+			struct timespec ts = { interval_ms / 1000, (interval_ms % 1000) * 1000000 };
+			mu_shm_page *t = prev; prev = cur; cur = t;
+			nanosleep(&ts, NULL);
+			snapshot(&m, cur);
+			top(prev, cur, name, tty);
+		}
+	}
+
+	free(prev);
+	free(cur);
+	munmap(m.page, m.size);
+}
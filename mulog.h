@@ -16,9 +16,14 @@
 
 #pragma once
 
+#include <stdio.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdatomic.h>
+#include <threads.h>
+#include <time.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -26,14 +31,217 @@ extern "C" {
 
 /*
  * Debug
+ *
+ * `MULE_LOG_LEVEL` sets the highest level compiled in: 0 removes all
+ * messages, 1 keeps debug messages and removes trace messages, 2 (the
+ * default) keeps both. removed calls still type-check their arguments but
+ * generate no code. at runtime a message is written when the global
+ * `debug` level or the level of its category is high enough; the test is
+ * marked unlikely and the record path is cold so that disabled messages
+ * cost one predicted branch and stay out of the hot path's i-cache.
+ * category levels are a weak definition shared by every translation unit,
+ * like `debug`; compilers without weak symbols need them defined once:
+ *
+ *     int mu_log_levels[mu_log_cat_count];
+ *
+ * - `mu_log_cat_worker` - worker threads
+ * - `mu_log_cat_submit` - mule_submit and mule_start
+ * - `mu_log_cat_sync` - mule_sync, mule_stop and arena management
  */
 
+#ifndef MULE_LOG_LEVEL
+#define MULE_LOG_LEVEL 2
+#endif
+
+#if defined(__GNUC__)
+#define MU_LOG_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#define MU_LOG_COLD __attribute__((cold, noinline))
+#else
+#define MU_LOG_UNLIKELY(x) (x)
+#define MU_LOG_COLD
+#endif
+
+enum {
+    mu_log_cat_default,
+    mu_log_cat_worker,
+    mu_log_cat_submit,
+    mu_log_cat_sync,
+    mu_log_cat_count,
+};
+
 extern int debug;
+#if defined(__GNUC__)
+__attribute__((weak)) int mu_log_levels[mu_log_cat_count];
+#else
+extern int mu_log_levels[mu_log_cat_count];
+#endif
 
 static void mu_set_debug(int level) { debug = level; }
+static void mu_set_log_level(int cat, int level) { mu_log_levels[cat] = level; }
 static void log_printf(const char* fmt, ...);
-#define debugf(...) if(debug > 0) log_printf(__VA_ARGS__)
-#define tracef(...) if(debug > 1) log_printf(__VA_ARGS__)
+
+#define mu_log_enabled(cat,level) (MULE_LOG_LEVEL >= (level) && \
+    MU_LOG_UNLIKELY(debug >= (level) || mu_log_levels[cat] >= (level)))
+#define mu_debugf(cat,...) do { if (mu_log_enabled(cat, 1)) mu_logf(__VA_ARGS__); } while (0)
+#define mu_tracef(cat,...) do { if (mu_log_enabled(cat, 2)) mu_logf(__VA_ARGS__); } while (0)
+#define debugf(...) mu_debugf(mu_log_cat_default, __VA_ARGS__)
+#define tracef(...) mu_tracef(mu_log_cat_default, __VA_ARGS__)
+
+
+/*
+ * ring logger:
+ *
+ * `mu_logf(fmt, ...)` does not format on the calling thread. it stores the
+ * format pointer, a timestamp and up to eight arguments as a fixed-size
+ * binary record in a ring owned by the calling thread, and a background
+ * flusher formats and writes the records to stderr, so turning on logging
+ * does not put a locked fwrite on the paths being debugged. rings are
+ * single-producer single-consumer and never block; records are dropped
+ * and counted when a ring is full.
+ *
+ * arguments are captured with _Generic: `char*` arguments are copied into
+ * the record (truncated to the space left), floating point is stored as
+ * double and everything else is stored as a 64-bit integer that is cast
+ * back according to the conversion in the format. pointers for `%p` must
+ * be `void*`. format strings must have static storage duration.
+ *
+ * - `mu_log_mode_async` - background flusher writes to stderr (default)
+ * - `mu_log_mode_sync` - format and write on the calling thread
+ * - `mu_log_mode_hold` - keep records in the rings for `mu_log_dump`
+ *
+ * `mu_log_flush()` drains the rings synchronously and runs at exit;
+ * it leaves held records in place.
+ * `mu_log_dump(path)` drains the rings to a binary file with a string
+ * table for the format strings, which `mulog_decode` prints offline.
+ *
+ * the ring list, thread ids and flusher are a weak definition shared by
+ * every translation unit, so records from all of them are merged in
+ * timestamp order by one flusher. the flusher sleeps on a condition while
+ * the rings are empty and the first record after that wakes it.
+ * compilers without weak symbols need the state defined once:
+ *
+ *     mu_log_state mu_log_shared = MU_LOG_STATE_INIT;
+ *     _Thread_local mu_log_ring *mu_log_tls;
+ */
+
+enum {
+    mu_log_mode_async,
+    mu_log_mode_sync,
+    mu_log_mode_hold,
+};
+
+enum {
+    mu_log_max_args = 8,
+    mu_log_record_size = 256,
+    mu_log_ring_records = 256,
+    mu_log_flush_interval_ns = 1000000, /* 1 millisecond */
+};
+
+typedef struct mu_log_rec mu_log_rec;
+typedef struct mu_log_ring mu_log_ring;
+typedef struct mu_log_dump_rec mu_log_dump_rec;
+typedef struct mu_log_state mu_log_state;
+
+struct mu_log_rec
+{
+    const char *fmt;
+    uint64_t ts;
+    uint32_t nargs;
+    uint32_t str_used;
+    uint64_t args[mu_log_max_args];
+    char strs[mu_log_record_size - 24 - 8 * mu_log_max_args];
+};
+
+struct mu_log_ring
+{
+    _Atomic(size_t) head;
+    char pad0[64 - sizeof(size_t)];
+    _Atomic(size_t) tail;
+    _Atomic(size_t) dropped;
+    size_t dropped_seen;
+    uint32_t tid;
+    _Atomic(int) dead;
+    mu_log_ring *next;
+    mu_log_rec recs[mu_log_ring_records];
+};
+
+/* dump record, the format pointer is replaced by a string table index */
+struct mu_log_dump_rec
+{
+    uint64_t ts;
+    uint32_t tid;
+    uint32_t fmt_idx;
+    uint32_t nargs;
+    uint32_t str_used;
+    uint64_t args[mu_log_max_args];
+    char strs[sizeof(((mu_log_rec*)0)->strs)];
+};
+
+static const char mu_log_dump_magic[8] = { 'M', 'U', 'L', 'O', 'G', 0, 0, 1 };
+
+struct mu_log_state
+{
+    once_flag once;
+    mtx_t lock;
+    cnd_t wake;
+    tss_t key;
+    mu_log_ring *rings;
+    uint32_t next_tid;
+    _Atomic(int) mode;
+    _Atomic(int) idle;
+};
+
+#define MU_LOG_STATE_INIT { ONCE_FLAG_INIT }
+
+#if defined(__GNUC__)
+__attribute__((weak)) mu_log_state mu_log_shared = MU_LOG_STATE_INIT;
+__attribute__((weak)) _Thread_local mu_log_ring *mu_log_tls;
+#else
+extern mu_log_state mu_log_shared;
+extern _Thread_local mu_log_ring *mu_log_tls;
+#endif
+
+static void mu_log_config(int mode);
+static void mu_log_flush();
+static int mu_log_dump(const char *path);
+static size_t mu_log_format(char *buf, size_t size, const char *fmt,
+    const uint64_t *args, uint32_t nargs, const char *strs, size_t strs_size);
+
+#define _MU_LOG_NTH(_0,_1,_2,_3,_4,_5,_6,_7,_8,N,...) N
+#define _MU_LOG_CAT(a,b) a##b
+#define _MU_LOG_SEL(a,b) _MU_LOG_CAT(a,b)
+#define _MU_LOG_ARG(r,i,x) _Generic((x), \
+    char*: _mu_log_str, const char*: _mu_log_str, \
+    void*: _mu_log_ptr, const void*: _mu_log_ptr, \
+    float: _mu_log_f64, double: _mu_log_f64, \
+    default: _mu_log_u64)(r, i, x)
+
+#define mu_logf(...) _MU_LOG_SEL(_mu_logf_, \
+    _MU_LOG_NTH(__VA_ARGS__,8,7,6,5,4,3,2,1,0,_))(__VA_ARGS__)
+
+#define _MU_LOG_BEGIN(f,n) do { mu_log_rec *_r = _mu_log_begin(f, n); if (_r) {
+#define _MU_LOG_END } _mu_log_commit(_r); } while (0)
+#define _mu_logf_0(f) _MU_LOG_BEGIN(f,0) _MU_LOG_END
+#define _mu_logf_1(f,a) _MU_LOG_BEGIN(f,1) _MU_LOG_ARG(_r,0,a); _MU_LOG_END
+#define _mu_logf_2(f,a,b) _MU_LOG_BEGIN(f,2) _MU_LOG_ARG(_r,0,a); \
+    _MU_LOG_ARG(_r,1,b); _MU_LOG_END
+#define _mu_logf_3(f,a,b,c) _MU_LOG_BEGIN(f,3) _MU_LOG_ARG(_r,0,a); \
+    _MU_LOG_ARG(_r,1,b); _MU_LOG_ARG(_r,2,c); _MU_LOG_END
+#define _mu_logf_4(f,a,b,c,d) _MU_LOG_BEGIN(f,4) _MU_LOG_ARG(_r,0,a); \
+    _MU_LOG_ARG(_r,1,b); _MU_LOG_ARG(_r,2,c); _MU_LOG_ARG(_r,3,d); _MU_LOG_END
+#define _mu_logf_5(f,a,b,c,d,e) _MU_LOG_BEGIN(f,5) _MU_LOG_ARG(_r,0,a); \
+    _MU_LOG_ARG(_r,1,b); _MU_LOG_ARG(_r,2,c); _MU_LOG_ARG(_r,3,d); \
+    _MU_LOG_ARG(_r,4,e); _MU_LOG_END
+#define _mu_logf_6(f,a,b,c,d,e,g) _MU_LOG_BEGIN(f,6) _MU_LOG_ARG(_r,0,a); \
+    _MU_LOG_ARG(_r,1,b); _MU_LOG_ARG(_r,2,c); _MU_LOG_ARG(_r,3,d); \
+    _MU_LOG_ARG(_r,4,e); _MU_LOG_ARG(_r,5,g); _MU_LOG_END
+#define _mu_logf_7(f,a,b,c,d,e,g,h) _MU_LOG_BEGIN(f,7) _MU_LOG_ARG(_r,0,a); \
+    _MU_LOG_ARG(_r,1,b); _MU_LOG_ARG(_r,2,c); _MU_LOG_ARG(_r,3,d); \
+    _MU_LOG_ARG(_r,4,e); _MU_LOG_ARG(_r,5,g); _MU_LOG_ARG(_r,6,h); _MU_LOG_END
+#define _mu_logf_8(f,a,b,c,d,e,g,h,k) _MU_LOG_BEGIN(f,8) _MU_LOG_ARG(_r,0,a); \
+    _MU_LOG_ARG(_r,1,b); _MU_LOG_ARG(_r,2,c); _MU_LOG_ARG(_r,3,d); \
+    _MU_LOG_ARG(_r,4,e); _MU_LOG_ARG(_r,5,g); _MU_LOG_ARG(_r,6,h); \
+    _MU_LOG_ARG(_r,7,k); _MU_LOG_END
 
 
 /*
@@ -62,6 +270,380 @@ static void log_printf(const char* fmt, ...)
     if (hbuf) free(hbuf);
 }
 
+static void _mu_log_u64(mu_log_rec *r, int i, uint64_t v) { r->args[i] = v; }
+static void _mu_log_f64(mu_log_rec *r, int i, double v) { memcpy(&r->args[i], &v, sizeof(v)); }
+static void _mu_log_ptr(mu_log_rec *r, int i, const void *v) { r->args[i] = (uintptr_t)v; }
+
+/* copy the string into the record, the argument is its offset */
+static MU_LOG_COLD void _mu_log_str(mu_log_rec *r, int i, const char *s)
+{
+    size_t room = sizeof(r->strs) - r->str_used;
+    if (!s) s = "(null)";
+    size_t len = strlen(s);
+    if (len >= room) len = room ? room - 1 : 0;
+    r->args[i] = r->str_used;
+    if (room) {
+        memcpy(r->strs + r->str_used, s, len);
+        r->strs[r->str_used + len] = '\0';
+        r->str_used += (uint32_t)len + 1;
+    } else {
+        r->args[i] = sizeof(r->strs) - 1;
+    }
+}
+
+static void _mu_log_thread_exit(void *arg)
+{
+    atomic_store_explicit(&((mu_log_ring*)arg)->dead, 1, __ATOMIC_RELEASE);
+}
+
+static mu_log_ring* _mu_log_oldest();
+static size_t _mu_log_drain();
+
+/*
+ * drain the rings every flush interval while records arrive. once a pass
+ * finds them empty, mark the flusher idle and sleep until a producer sees
+ * the mark. the recheck after the mark pairs with the fence in commit.
+ */
+static int _mu_log_flusher(void *arg)
+{
+    mu_log_state *st = &mu_log_shared;
+
+    mtx_lock(&st->lock);
+    for (;;) {
+        if (_mu_log_drain()) {
+            struct timespec ts = { 0, mu_log_flush_interval_ns };
+            mtx_unlock(&st->lock);
+            nanosleep(&ts, NULL);
+            mtx_lock(&st->lock);
+            continue;
+        }
+        atomic_store_explicit(&st->idle, 1, __ATOMIC_SEQ_CST);
+        int mode = atomic_load_explicit(&st->mode, __ATOMIC_RELAXED);
+        if (mode != mu_log_mode_hold && _mu_log_oldest()) {
+            atomic_store_explicit(&st->idle, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+        while (atomic_load_explicit(&st->idle, __ATOMIC_RELAXED)) {
+            cnd_wait(&st->wake, &st->lock);
+        }
+    }
+    return 0;
+}
+
+static MU_LOG_COLD void _mu_log_wake()
+{
+    mu_log_state *st = &mu_log_shared;
+    mtx_lock(&st->lock);
+    atomic_store_explicit(&st->idle, 0, __ATOMIC_RELAXED);
+    cnd_signal(&st->wake);
+    mtx_unlock(&st->lock);
+}
+
+static void _mu_log_init()
+{
+    thrd_t thread;
+    mtx_init(&mu_log_shared.lock, mtx_plain);
+    cnd_init(&mu_log_shared.wake);
+    tss_create(&mu_log_shared.key, _mu_log_thread_exit);
+    atexit(mu_log_flush);
+    if (thrd_create(&thread, _mu_log_flusher, NULL) == thrd_success) {
+        thrd_detach(thread);
+    }
+}
+
+static mu_log_ring* _mu_log_ring_new()
+{
+    mu_log_state *st = &mu_log_shared;
+    call_once(&st->once, _mu_log_init);
+    mu_log_ring *ring = (mu_log_ring*)calloc(1, sizeof(mu_log_ring));
+    if (!ring) return NULL;
+    mtx_lock(&st->lock);
+    ring->tid = st->next_tid++;
+    ring->next = st->rings;
+    st->rings = ring;
+    mtx_unlock(&st->lock);
+    tss_set(st->key, ring);
+    return mu_log_tls = ring;
+}
+
+static MU_LOG_COLD mu_log_rec* _mu_log_begin(const char *fmt, uint32_t nargs)
+{
+    mu_log_ring *ring = mu_log_tls ? mu_log_tls : _mu_log_ring_new();
+    if (!ring) return NULL;
+    size_t head = atomic_load_explicit(&ring->head, __ATOMIC_RELAXED);
+    size_t tail = atomic_load_explicit(&ring->tail, __ATOMIC_ACQUIRE);
+    if (head - tail == mu_log_ring_records) {
+        atomic_store_explicit(&ring->dropped, atomic_load_explicit(&ring->dropped,
+            __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    mu_log_rec *r = &ring->recs[head % mu_log_ring_records];
+    r->fmt = fmt;
+    r->ts = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    r->nargs = nargs;
+    r->str_used = 0;
+    return r;
+}
+
+static void _mu_log_write_rec(const mu_log_rec *r)
+{
+    char buf[1024];
+    size_t len = mu_log_format(buf, sizeof(buf), r->fmt, r->args, r->nargs,
+        r->strs, r->str_used);
+    fwrite(buf, 1, len, stderr);
+}
+
+static MU_LOG_COLD void _mu_log_commit(mu_log_rec *r)
+{
+    mu_log_ring *ring = mu_log_tls;
+    int mode = atomic_load_explicit(&mu_log_shared.mode, __ATOMIC_RELAXED);
+    if (mode == mu_log_mode_sync) {
+        _mu_log_write_rec(r);
+        return;
+    }
+    atomic_store_explicit(&ring->head, atomic_load_explicit(&ring->head,
+        __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE);
+    /* order the record before the idle check, the flusher does the reverse */
+    atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (mode != mu_log_mode_hold &&
+        atomic_load_explicit(&mu_log_shared.idle, __ATOMIC_RELAXED)) {
+        _mu_log_wake();
+    }
+}
+
+static void mu_log_config(int mode)
+{
+    call_once(&mu_log_shared.once, _mu_log_init);
+    atomic_store_explicit(&mu_log_shared.mode, mode, __ATOMIC_RELAXED);
+    /* held records become due when leaving hold mode */
+    if (mode != mu_log_mode_hold) _mu_log_wake();
+}
+
+/* oldest pending record across all rings, called with the lock held */
+static mu_log_ring* _mu_log_oldest()
+{
+    mu_log_ring *oldest = NULL;
+    uint64_t oldest_ts = UINT64_MAX;
+    for (mu_log_ring *ring = mu_log_shared.rings; ring; ring = ring->next) {
+        size_t tail = atomic_load_explicit(&ring->tail, __ATOMIC_RELAXED);
+        if (tail == atomic_load_explicit(&ring->head, __ATOMIC_ACQUIRE)) continue;
+        uint64_t ts = ring->recs[tail % mu_log_ring_records].ts;
+        if (ts < oldest_ts) { oldest = ring; oldest_ts = ts; }
+    }
+    return oldest;
+}
+
+/* unlink rings of exited threads once drained, called with the lock held */
+static void _mu_log_reap()
+{
+    for (mu_log_ring **pring = &mu_log_shared.rings; *pring; ) {
+        mu_log_ring *ring = *pring;
+        if (atomic_load_explicit(&ring->dead, __ATOMIC_ACQUIRE) &&
+            atomic_load_explicit(&ring->tail, __ATOMIC_RELAXED) ==
+            atomic_load_explicit(&ring->head, __ATOMIC_ACQUIRE)) {
+            *pring = ring->next;
+            free(ring);
+        } else {
+            pring = &ring->next;
+        }
+    }
+}
+
+/*
+ * format and write all pending records in timestamp order, called with the
+ * lock held. returns the number of records written. consumers serialize on
+ * the lock, producers only take it to wake an idle flusher.
+ */
+static size_t _mu_log_drain()
+{
+    mu_log_ring *ring;
+    size_t written = 0;
+
+    int mode = atomic_load_explicit(&mu_log_shared.mode, __ATOMIC_RELAXED);
+    if (mode == mu_log_mode_hold) return 0;
+    while ((ring = _mu_log_oldest())) {
+        size_t tail = atomic_load_explicit(&ring->tail, __ATOMIC_RELAXED);
+        _mu_log_write_rec(&ring->recs[tail % mu_log_ring_records]);
+        atomic_store_explicit(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+        written++;
+    }
+    for (ring = mu_log_shared.rings; ring; ring = ring->next) {
+        size_t dropped = atomic_load_explicit(&ring->dropped, __ATOMIC_RELAXED);
+        if (dropped != ring->dropped_seen) {
+            fprintf(stderr, "mulog: thread %u dropped %zu records\n",
+                ring->tid, dropped - ring->dropped_seen);
+            ring->dropped_seen = dropped;
+        }
+    }
+    _mu_log_reap();
+    if (written) fflush(stderr);
+    return written;
+}
+
+static void mu_log_flush()
+{
+    call_once(&mu_log_shared.once, _mu_log_init);
+    mtx_lock(&mu_log_shared.lock);
+    _mu_log_drain();
+    fflush(stderr);
+    mtx_unlock(&mu_log_shared.lock);
+}
+
+/*
+ * drain all pending records to `path` for `mulog_decode`. the file holds
+ * the magic, the string and record counts, the string table as length
+ * prefixed strings, then the records. returns -1 on error.
+ */
+static int mu_log_dump(const char *path)
+{
+    mu_log_ring *ring;
+    const char **table = NULL;
+    mu_log_dump_rec *recs = NULL;
+    uint32_t nstrings = 0, nrecs = 0, cap = 0;
+    int ret = -1;
+    FILE *f;
+
+    if (!(f = fopen(path, "wb"))) return -1;
+
+    call_once(&mu_log_shared.once, _mu_log_init);
+    mtx_lock(&mu_log_shared.lock);
+    while ((ring = _mu_log_oldest())) {
+        size_t tail = atomic_load_explicit(&ring->tail, __ATOMIC_RELAXED);
+        mu_log_rec *r = &ring->recs[tail % mu_log_ring_records];
+        if (nrecs == cap) {
+            cap = cap ? cap * 2 : 256;
+            mu_log_dump_rec *nr = (mu_log_dump_rec*)realloc(recs, cap * sizeof(*nr));
+            const char **nt = (const char**)realloc(table, cap * sizeof(const char*));
+            if (nr) recs = nr;
+            if (nt) table = nt;
+            if (!nr || !nt) break;
+        }
+        uint32_t idx = 0;
+        while (idx < nstrings && table[idx] != r->fmt) idx++;
+        if (idx == nstrings) table[nstrings++] = r->fmt;
+        mu_log_dump_rec *d = &recs[nrecs++];
+        memset(d, 0, sizeof(*d));
+        d->ts = r->ts;
+        d->tid = ring->tid;
+        d->fmt_idx = idx;
+        d->nargs = r->nargs;
+        d->str_used = r->str_used;
+        memcpy(d->args, r->args, sizeof(d->args));
+        memcpy(d->strs, r->strs, r->str_used);
+        atomic_store_explicit(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    }
+    _mu_log_reap();
+    mtx_unlock(&mu_log_shared.lock);
+
+    size_t magic_len = sizeof(mu_log_dump_magic);
+    if (fwrite(mu_log_dump_magic, 1, magic_len, f) != magic_len ||
+        fwrite(&nstrings, sizeof(nstrings), 1, f) != 1 ||
+        fwrite(&nrecs, sizeof(nrecs), 1, f) != 1) goto out;
+    for (uint32_t i = 0; i < nstrings; i++) {
+        uint32_t len = (uint32_t)strlen(table[i]);
+        if (fwrite(&len, sizeof(len), 1, f) != 1 ||
+            fwrite(table[i], 1, len, f) != len) goto out;
+    }
+    if (nrecs && fwrite(recs, sizeof(mu_log_dump_rec), nrecs, f) != nrecs) goto out;
+    ret = 0;
+out:
+    if (fclose(f)) ret = -1;
+    free(table);
+    free(recs);
+    return ret;
+}
+
+/*
+ * format a record. each conversion is passed to snprintf on its own with
+ * the stored argument cast to the type its length modifier names. string
+ * arguments are offsets into the first strs_size bytes of strs, an offset
+ * outside of them prints as "(bad)".
+ */
+static size_t mu_log_format(char *buf, size_t size, const char *fmt,
+    const uint64_t *args, uint32_t nargs, const char *strs, size_t strs_size)
+{
+    size_t len = 0;
+    uint32_t arg = 0;
+
+#define _MU_LOG_PUT(...) do { \
+    int _n = snprintf(buf + len, size - len, __VA_ARGS__); \
+    if (_n > 0) len += (size_t)_n < size - len ? (size_t)_n : size - len - 1; \
+} while (0)
+
+    if (!size) return 0;
+    buf[0] = '\0';
+    while (*fmt && len + 1 < size) {
+        if (*fmt != '%' || fmt[1] == '%') {
+            buf[len++] = *fmt;
+            fmt += *fmt == '%' ? 2 : 1;
+            buf[len] = '\0';
+            continue;
+        }
+
+        /* copy the conversion, substituting `*` width and precision */
+        char spec[32];
+        size_t n = 0;
+        spec[n++] = *fmt++;
+        while (*fmt && strchr("-+ #0123456789.*", *fmt) && n < sizeof(spec) - 24) {
+            if (*fmt == '*') {
+                n += snprintf(spec + n, sizeof(spec) - n, "%d",
+                    arg < nargs ? (int)args[arg++] : 0);
+                fmt++;
+            } else {
+                spec[n++] = *fmt++;
+            }
+        }
+        char lmod[3] = { 0 };
+        while (*fmt && strchr("hljztL", *fmt) && strlen(lmod) < 2) {
+            lmod[strlen(lmod)] = *fmt;
+            spec[n++] = *fmt++;
+        }
+        char conv = *fmt ? *fmt++ : 0;
+        spec[n++] = conv;
+        spec[n] = '\0';
+
+        uint64_t v = arg < nargs ? args[arg++] : 0;
+        int ll = !strcmp(lmod, "ll") || !strcmp(lmod, "j");
+        int l = !strcmp(lmod, "l") || !strcmp(lmod, "z") ||
+            !strcmp(lmod, "t");
+        double d;
+        switch (conv) {
+        case 'd': case 'i':
+            if (ll) _MU_LOG_PUT(spec, (long long)v);
+            else if (l) _MU_LOG_PUT(spec, (long)v);
+            else _MU_LOG_PUT(spec, (int)v);
+            break;
+        case 'u': case 'x': case 'X': case 'o':
+            if (ll) _MU_LOG_PUT(spec, (unsigned long long)v);
+            else if (l) _MU_LOG_PUT(spec, (unsigned long)v);
+            else _MU_LOG_PUT(spec, (unsigned)v);
+            break;
+        case 'c':
+            _MU_LOG_PUT(spec, (int)v);
+            break;
+        case 's':
+            _MU_LOG_PUT(spec, v < strs_size ? strs + v : "(bad)");
+            break;
+        case 'p':
+            _MU_LOG_PUT(spec, (void*)(uintptr_t)v);
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            memcpy(&d, &v, sizeof(d));
+            if (lmod[0] == 'L') _MU_LOG_PUT(spec, (long double)d);
+            else _MU_LOG_PUT(spec, d);
+            break;
+        default:
+            break;
+        }
+    }
+
+#undef _MU_LOG_PUT
+
+    return len;
+}
+
 #ifdef __cplusplus
 }
 #endif
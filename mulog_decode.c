@@ -0,0 +1,87 @@
+/*
+ * Copyright 2021, Michael Clark <micheljclark@mac.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * mulog_decode - print a ring dump written by mu_log_dump
+ *
+ * usage: mulog_decode <dump>
+ *
+ * each record is printed as `<seconds>.<nanoseconds> [<thread>] <message>`
+ * with the monotonic timestamp of the record and the logging thread.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mulog.h"
+
+int debug = 0;
+
+int main(int argc, const char **argv)
+{
+    char magic[sizeof(mu_log_dump_magic)], buf[1024];
+    uint32_t nstrings, nrecs;
+    char **table;
+    mu_log_dump_rec rec;
+    FILE *f;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <dump>\n", argv[0]);
+        return 2;
+    }
+    if (!(f = fopen(argv[1], "rb"))) {
+        perror(argv[1]);
+        return 1;
+    }
+    if (fread(magic, 1, sizeof(magic), f) != sizeof(magic) ||
+        memcmp(magic, mu_log_dump_magic, sizeof(magic)) ||
+        fread(&nstrings, sizeof(nstrings), 1, f) != 1 ||
+        fread(&nrecs, sizeof(nrecs), 1, f) != 1) {
+        fprintf(stderr, "%s: not a mulog dump\n", argv[1]);
+        return 1;
+    }
+
+    table = (char**)calloc(nstrings ? nstrings : 1, sizeof(char*));
+    for (uint32_t i = 0; i < nstrings; i++) {
+        uint32_t len;
+        if (fread(&len, sizeof(len), 1, f) != 1 || !(table[i] = (char*)malloc(len + 1)) ||
+            fread(table[i], 1, len, f) != len) {
+            fprintf(stderr, "%s: truncated string table\n", argv[1]);
+            return 1;
+        }
+        table[i][len] = '\0';
+    }
+
+    for (uint32_t i = 0; i < nrecs; i++) {
+        if (fread(&rec, sizeof(rec), 1, f) != 1 || rec.fmt_idx >= nstrings ||
+            rec.nargs > mu_log_max_args || rec.str_used > sizeof(rec.strs)) {
+            fprintf(stderr, "%s: bad record %u\n", argv[1], i);
+            return 1;
+        }
+        rec.strs[sizeof(rec.strs) - 1] = '\0';
+        size_t len = mu_log_format(buf, sizeof(buf), table[rec.fmt_idx],
+            rec.args, rec.nargs, rec.strs, rec.str_used);
+        printf("%llu.%09llu [%u] %.*s%s", (unsigned long long)(rec.ts / 1000000000ull),
+            (unsigned long long)(rec.ts % 1000000000ull), rec.tid, (int)len, buf,
+            len && buf[len - 1] == '\n' ? "" : "\n");
+    }
+
+    for (uint32_t i = 0; i < nstrings; i++) free(table[i]);
+    free(table);
+    fclose(f);
+
+    return 0;
+}
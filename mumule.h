@@ -17,13 +17,42 @@
 #pragma once
 
 #undef NDEBUG
+#include <stdio.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <stdatomic.h>
 #include <string.h>
 #include <threads.h>
 #include <time.h>
 #include <assert.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#if defined(__linux__)
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+/* glibc only declares these with _GNU_SOURCE, the values are the Linux ABI */
+#if !defined(SCHED_BATCH)
+#define SCHED_BATCH 3
+#endif
+#if !defined(SCHED_IDLE)
+#define SCHED_IDLE 5
+#endif
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/perf_event.h>)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#define MULE_HAVE_PERF 1
+#endif
+#endif
 
 #include "mulog.h"
 
@@ -35,6 +64,64 @@
 #define ALIGNED(x)
 #endif
 
+/*
+ * USDT probes:
+ *
+ * static tracepoints in the `mumule` provider for bpftrace, perf probe and
+ * systemtap. a probe site is a single nop until a tracer attaches, and the
+ * probes compile out when <sys/sdt.h> is missing or MULE_DISABLE_USDT is
+ * defined. the mule pointer is passed first so probes can filter queues.
+ *
+ * - `item__begin(mule, thr_idx, item_idx)` and `item__end(...)`
+ * - `claim__fail(mule, thr_idx, item_idx)` - claim lost to another worker
+ * - `park(mule, thr_idx)` and `wake(mule, thr_idx, timed_out)`
+ * - `submit(mule, count, queued)`
+ * - `sync__begin(mule, queued)` and `sync__end(mule, queued)`
+ *
+ *     bpftrace -e 'usdt:./test_mumule:mumule:item__begin { @[arg1] = count(); }'
+ */
+
+#if defined(__has_include) && !defined(MULE_DISABLE_USDT)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define MULE_HAVE_USDT 1
+#endif
+#endif
+
+#if defined(MULE_HAVE_USDT)
+#define MULE_PROBE2(name,a,b) DTRACE_PROBE2(mumule, name, a, b)
+#define MULE_PROBE3(name,a,b,c) DTRACE_PROBE3(mumule, name, a, b, c)
+#else
+#define MULE_PROBE2(name,a,b) do {} while (0)
+#define MULE_PROBE3(name,a,b,c) do {} while (0)
+#endif
+
+/*
+ * fault injection:
+ *
+ * with MULE_FAULT_INJECTION defined, `mule_fault_hook` is called at the
+ * points where a delay widens a race window: before the claim
+ * compare-and-swap, between a worker finding the queue empty and parking,
+ * and between the dispatcher finding the queue incomplete and waiting.
+ * the stress harness sleeps there to expose lost-wakeup stalls. without
+ * the define the hooks compile out.
+ */
+
+enum {
+    mumule_fault_claim,
+    mumule_fault_park,
+    mumule_fault_sync,
+};
+
+#if defined(MULE_FAULT_INJECTION)
+typedef void(*mumule_fault_fn)(int point);
+static mumule_fault_fn mule_fault_hook;
+#define MULE_FAULT(point) do { \
+    if (mule_fault_hook) mule_fault_hook(mumule_fault_##point); } while (0)
+#else
+#define MULE_FAULT(point) do {} while (0)
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -45,6 +132,56 @@ struct mu_mule;
 typedef struct mu_mule mu_mule;
 struct mu_thread;
 typedef struct mu_thread mu_thread;
+struct mu_shared;
+typedef struct mu_shared mu_shared;
+struct mu_scratch;
+typedef struct mu_scratch mu_scratch;
+struct mu_scratch_block;
+typedef struct mu_scratch_block mu_scratch_block;
+struct mu_thread_attr;
+typedef struct mu_thread_attr mu_thread_attr;
+struct mu_counters;
+typedef struct mu_counters mu_counters;
+struct mu_worker_stats;
+typedef struct mu_worker_stats mu_worker_stats;
+struct mu_stats;
+typedef struct mu_stats mu_stats;
+struct mu_hist;
+typedef struct mu_hist mu_hist;
+struct mu_slowest;
+typedef struct mu_slowest mu_slowest;
+struct mu_thread_hist;
+typedef struct mu_thread_hist mu_thread_hist;
+struct mu_histogram;
+typedef struct mu_histogram mu_histogram;
+struct mu_slow_item;
+typedef struct mu_slow_item mu_slow_item;
+struct mu_trace_event;
+typedef struct mu_trace_event mu_trace_event;
+struct mu_trace_ring;
+typedef struct mu_trace_ring mu_trace_ring;
+struct mu_shm_worker;
+typedef struct mu_shm_worker mu_shm_worker;
+struct mu_shm_page;
+typedef struct mu_shm_page mu_shm_page;
+struct mu_publisher;
+typedef struct mu_publisher mu_publisher;
+struct mu_worker_epoch;
+typedef struct mu_worker_epoch mu_worker_epoch;
+struct mu_epoch_report;
+typedef struct mu_epoch_report mu_epoch_report;
+struct mu_perf_counters;
+typedef struct mu_perf_counters mu_perf_counters;
+struct mu_epoch;
+typedef struct mu_epoch mu_epoch;
+struct mu_straggler;
+typedef struct mu_straggler mu_straggler;
+struct mu_watchdog;
+typedef struct mu_watchdog mu_watchdog;
+struct mu_record_event;
+typedef struct mu_record_event mu_record_event;
+struct mu_recorder;
+typedef struct mu_recorder mu_recorder;
 
 /*
  * mumule thread pool:
@@ -55,6 +192,27 @@ typedef struct mu_thread mu_thread;
  * - `mule_submit(mule,n)` to queue work
  * - `mule_sync(mule)` to quench the queue
  * - `mule_reset(mule)` to clear counters
+ * - `mule_attach(arena, host, limit)` to serve an arena with host threads
+ * - `mule_detach(arena)` to quench the arena and detach it from its host
+ * - `mule_shared_attach(arena, limit)` to attach to the process-wide pool
+ * - `mule_shared_detach(arena)` to detach from the process-wide pool
+ * - `mule_hardware_threads()` for the number of threads the pool uses
+ * - `mule_scratch_alloc(mule, thr_idx, size, align)` for kernel scratch
+ * - `mule_scratch_reset(mule)` to release all scratch in bulk
+ * - `mule_thread_attr(mule, attr)` to set worker stack, name and policy
+ * - `mule_stats(mule, stats, workers)` to snapshot pool statistics
+ * - `mule_histogram(mule, which, hist)` to merge latency histograms
+ * - `mule_slowest(mule, items, n)` to list the slowest work-items
+ * - `mule_epoch_report(mule, report, workers)` for the last sync epoch
+ * - `mule_perf(mule, total, workers)` to read hardware counters
+ * - `mule_trace_config(mule, events, sample_rate)` to record timelines
+ * - `mule_trace_write(mule, path)` to write a Chrome trace event file
+ * - `mule_publish(mule, name, interval_ns)` to publish live metrics
+ * - `mule_unpublish(mule)` to stop publishing and remove the metrics page
+ * - `mule_watchdog(mule, threshold, factor, fn, arg)` to flag stragglers
+ * - `mule_watchdog_stop(mule)` to stop the watchdog
+ * - `mule_record_config(mule, max_items)` to record item durations
+ * - `mule_record_write(mule, path)` to write a recording for mulesim
  *
  * mumule example program:
  *
@@ -72,6 +230,7 @@ typedef struct mu_thread mu_thread;
  */
 
 typedef void(*mumule_work_fn)(void *arg, size_t thr_idx, size_t item_idx);
+typedef void(*mumule_straggler_fn)(void *arg, const mu_straggler *straggler);
 
 static void mule_init(mu_mule *mule, size_t num_threads, mumule_work_fn kernel, void *userdata);
 static size_t mule_submit(mu_mule *mule, size_t count);
@@ -80,9 +239,35 @@ static int mule_sync(mu_mule *mule);
 static int mule_reset(mu_mule *mule);
 static int mule_stop(mu_mule *mule);
 static int mule_destroy(mu_mule *mule);
+static int mule_attach(mu_mule *arena, mu_mule *host, size_t max_concurrency);
+static int mule_detach(mu_mule *arena);
+static int mule_shared_attach(mu_mule *arena, size_t max_concurrency);
+static int mule_shared_detach(mu_mule *arena);
+static size_t mule_hardware_threads();
+static void mule_scratch_config(mu_mule *mule, size_t block_size, int flags);
+static void* mule_scratch_alloc(mu_mule *mule, size_t thr_idx, size_t size, size_t align);
+static void mule_scratch_reset(mu_mule *mule);
+static void mule_thread_attr(mu_mule *mule, const mu_thread_attr *attr);
+static void mule_stats_config(mu_mule *mule, int flags);
+static void mule_stats(mu_mule *mule, mu_stats *stats, mu_worker_stats *workers);
+static void mule_histogram(mu_mule *mule, int which, mu_histogram *hist);
+static uint64_t mule_histogram_percentile(const mu_histogram *hist, double p);
+static size_t mule_slowest(mu_mule *mule, mu_slow_item *items, size_t n);
+static int mule_epoch_report(mu_mule *mule, mu_epoch_report *report, mu_worker_epoch *workers);
+static int mule_perf(mu_mule *mule, mu_perf_counters *total, mu_perf_counters *workers);
+static int mule_trace_config(mu_mule *mule, size_t events, size_t sample_rate);
+static int mule_trace_write(mu_mule *mule, const char *path);
+static int mule_publish(mu_mule *mule, const char *name, uint64_t interval_ns);
+static int mule_unpublish(mu_mule *mule);
+static int mule_watchdog(mu_mule *mule, uint64_t threshold_ns, double median_factor,
+    mumule_straggler_fn fn, void *arg);
+static int mule_watchdog_stop(mu_mule *mule);
+static int mule_record_config(mu_mule *mule, size_t max_items);
+static int mule_record_write(mu_mule *mule, const char *path);
 
 enum {
-    mumule_max_threads = 8,
+    mumule_max_threads = 256,
+    mumule_max_arenas = 16,
 
     /*
      * condition revalidation timeouts - time between revalidation of the
@@ -93,9 +278,539 @@ enum {
      */
     mumule_revalidate_work_available_ns = 10000000, /* 10 milliseconds */
     mumule_revalidate_queue_complete_ns = 1000000,  /* 1 millisecond */
+
+    /*
+     * per-worker scratch - blocks are 1 MiB by default or 2 MiB aligned
+     * multiples when backed by transparent huge pages, as are stacks.
+     */
+    mumule_scratch_block_size = 1 << 20,
+    mumule_scratch_huge_page_size = 2 << 20,
+};
+
+enum {
+    mumule_scratch_hugepages = (1 << 0),
+    mumule_scratch_reset_on_sync = (1 << 1),
+};
+
+enum {
+    mumule_stack_prefault = (1 << 0),
+    mumule_stack_hugepages = (1 << 1),
+};
+
+enum {
+    mumule_sched_default,
+    mumule_sched_batch,
+    mumule_sched_idle,
+};
+
+enum {
+    mumule_affinity_none,
+    mumule_affinity_compact,
+};
+
+/*
+ * worker thread attributes:
+ *
+ * - `stack_size` - worker stack size in bytes, zero for the default.
+ *   custom stacks are mapped by mule_start with a guard page and may be
+ *   prefaulted with `mumule_stack_prefault` or advised to use transparent
+ *   huge pages with `mumule_stack_hugepages`.
+ * - `name` - thread name prefix, workers are named `<name>-<idx>` so
+ *   they can be told apart in top and perf. NULL leaves names unchanged.
+ * - `sched` - `mumule_sched_batch` or `mumule_sched_idle` let throughput
+ *   pools yield to latency-critical threads (Linux only).
+ * - `affinity` - `mumule_affinity_compact` pins worker `idx` to the
+ *   idx'th cpu the process may run on, wrapping around, so benchmark
+ *   runs are comparable (Linux only).
+ */
+
+struct mu_thread_attr
+{
+    size_t           stack_size;
+    int              stack_flags;
+    int              sched;
+    const char*      name;
+    int              affinity;
+};
+
+/*
+ * per-worker scratch:
+ *
+ * each mu_thread owns a chain of bump-pointer blocks that kernels allocate
+ * temporary buffers from using their `thr_idx`, avoiding malloc contention
+ * in the kernel. there is no free; all scratch is released in bulk when the
+ * epoch of the owning mule advances, at `mule_reset`, `mule_scratch_reset`,
+ * or at each `mule_sync` with `mumule_scratch_reset_on_sync`. workers rewind
+ * their own chain between items when they see a new epoch so a reset never
+ * pulls memory out from under a running kernel. blocks are kept for reuse
+ * and unmapped by `mule_destroy`. kernels running in an arena allocate from
+ * the scratch of the host worker, and the host mule drives the epoch.
+ */
+
+struct mu_scratch_block { mu_scratch_block *next; size_t size; size_t used; size_t map_size; };
+struct mu_scratch { mu_scratch_block *head; mu_scratch_block *cur; size_t epoch; };
+
+enum {
+    mumule_stats_time = (1 << 0),
+    mumule_stats_histogram = (1 << 1),
+    mumule_stats_epoch = (1 << 2),
+    mumule_stats_perf = (1 << 3),
+};
+
+enum {
+    mumule_hist_kernel,
+    mumule_hist_delay,
+};
+
+enum {
+    /*
+     * latency histograms - values below 16 ticks are exact, larger values
+     * land in one of 16 linear sub-buckets per power of two for a relative
+     * error under 6.25% across the whole 64-bit range.
+     */
+    mumule_hist_sub_bits = 4,
+    mumule_hist_sub_count = 1 << mumule_hist_sub_bits,
+    mumule_hist_buckets = (64 - mumule_hist_sub_bits + 1) * mumule_hist_sub_count,
+    mumule_slowest_items = 8,
+};
+
+/*
+ * statistics:
+ *
+ * each worker counts into its own cache-aligned `mu_counters`. counters
+ * have a single writer so they are bumped with a relaxed load and store
+ * rather than a locked read-modify-write, and readers take a relaxed
+ * snapshot with `mule_stats`. counts are always on; timing the kernel
+ * costs two timestamp reads per item so `busy_ns` is only collected with
+ * `mumule_stats_time`. parks are on the slow path and are always timed.
+ * kernel timing uses the time-stamp counter on x86 and is converted to
+ * nanoseconds when read.
+ *
+ * - `items` - work-items run, including items of attached arenas
+ * - `busy_ns` - time inside the kernel
+ * - `park_ns` - time parked in cnd_timedwait waiting for work
+ * - `parks` - number of times the worker parked
+ * - `wake_signals` - parks ended by a signal from mule_submit or mule_sync
+ * - `wake_timeouts` - parks ended by the revalidation timeout
+ * - `cas_failures` - claims lost to another worker
+ *
+ * `syncs`, `sync_waits` and `sync_timeouts` count mule_sync calls, the
+ * times the dispatcher waited, and the waits that timed out.
+ */
+
+struct mu_counters
+{
+    _Atomic(uint64_t) items;
+    _Atomic(uint64_t) busy_ticks;
+    _Atomic(uint64_t) park_ns;
+    _Atomic(uint64_t) parks;
+    _Atomic(uint64_t) wake_signals;
+    _Atomic(uint64_t) wake_timeouts;
+    _Atomic(uint64_t) cas_failures;
+};
+
+struct mu_worker_stats
+{
+    uint64_t items;
+    uint64_t busy_ns;
+    uint64_t park_ns;
+    uint64_t parks;
+    uint64_t wake_signals;
+    uint64_t wake_timeouts;
+    uint64_t cas_failures;
+};
+
+struct mu_stats
+{
+    size_t num_threads;
+    uint64_t syncs;
+    uint64_t sync_waits;
+    uint64_t sync_timeouts;
+    mu_worker_stats total;
+};
+
+/*
+ * latency histograms:
+ *
+ * with `mumule_stats_histogram` each worker records two log-linear
+ * histograms in ticks: `mumule_hist_kernel`, the duration of each kernel
+ * call, and `mumule_hist_delay`, the delay from the most recent
+ * `mule_submit` to the queue an item came from until the item started.
+ * delay covers wake latency and the wait behind earlier items of the same
+ * batch, so a p99 that moves with delay but not with kernel time points
+ * at scheduling rather than at slow items. each worker also keeps its
+ * `mumule_slowest_items` slowest items under a seqlock so that
+ * `mule_slowest` can read them while the worker runs. histograms have a
+ * single writer and are merged lock-free on demand by `mule_histogram`.
+ * the item index of arenas is relative to the arena it was submitted to.
+ */
+
+struct mu_hist
+{
+    _Atomic(uint64_t) count;
+    _Atomic(uint64_t) sum;
+    _Atomic(uint64_t) min;
+    _Atomic(uint64_t) max;
+    _Atomic(uint64_t) buckets[mumule_hist_buckets];
+};
+
+struct mu_slowest
+{
+    _Atomic(uint32_t) seq;
+    uint32_t lowest;
+    _Atomic(uint64_t) ticks[mumule_slowest_items];
+    _Atomic(uint64_t) item_idx[mumule_slowest_items];
+};
+
+struct mu_thread_hist
+{
+    mu_hist kernel;
+    mu_hist delay;
+    mu_slowest slowest;
+};
+
+struct mu_histogram
+{
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    double ns_per_tick;
+    uint64_t buckets[mumule_hist_buckets];
+};
+
+struct mu_slow_item
+{
+    uint64_t ns;
+    size_t item_idx;
+    size_t thr_idx;
+};
+
+/*
+ * timeline tracing:
+ *
+ * `mule_trace_config` gives every worker, and the dispatching side of the
+ * host, a ring of fixed-size binary events that overwrite the oldest when
+ * full. workers record one in `sample_rate` items as a claim span and an
+ * item span, so with a high rate tracing can stay enabled in production;
+ * parks with their wake reason, submits and syncs are on the slow path
+ * and are always recorded. `mule_trace_write` converts the rings to the
+ * Chrome trace event format, which chrome://tracing and Perfetto load, to
+ * show load imbalance, idle gaps and wake cascades on a timeline. write
+ * the trace after mule_sync or mule_stop; rings written concurrently may
+ * yield torn events.
+ */
+
+enum {
+    mumule_trace_item,
+    mumule_trace_claim,
+    mumule_trace_claim_lost,
+    mumule_trace_park,
+    mumule_trace_submit,
+    mumule_trace_sync,
+};
+
+struct mu_trace_event
+{
+    uint64_t ticks;
+    uint64_t dur;
+    uint64_t arg;
+    uint64_t type;
+};
+
+struct mu_trace_ring
+{
+    _Atomic(size_t) head;
+    size_t mask;
+    size_t sample_rate;
+    size_t countdown;
+    mu_trace_event events[];
+};
+
+/*
+ * live metrics page:
+ *
+ * `mule_publish` maps a file in /dev/shm, `/dev/shm/mule-<name>` unless
+ * the name contains a slash, and starts a publisher thread that copies
+ * the queue counters and the per-worker statistics into it every
+ * `interval_ns`. workers are not involved and nothing is locked: the
+ * publisher is the only writer and brackets each update with a sequence
+ * count that is odd while the page is being written, so readers such as
+ * `mulestat` map the page read-only and retry a copy if the count was odd
+ * or moved. rates and utilization are derived by readers from successive
+ * snapshots.
+ */
+
+enum {
+    mumule_shm_version = 1,
+    mumule_publish_interval_ns = 100000000, /* 100 milliseconds */
+};
+
+struct mu_shm_worker
+{
+    uint64_t items;
+    uint64_t busy_ns;
+    uint64_t park_ns;
+    uint64_t parks;
+    uint64_t wake_timeouts;
+    uint64_t cas_failures;
+    uint64_t parked;
+    uint64_t reserved;
+};
+
+struct mu_shm_page
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t num_threads;
+    uint64_t pid;
+    uint64_t interval_ns;
+    _Atomic(uint64_t) seq;
+    uint64_t time_ns;
+    uint64_t updates;
+    uint64_t queued;
+    uint64_t processing;
+    uint64_t processed;
+    uint64_t syncs;
+    uint64_t sync_waits;
+    uint64_t sync_timeouts;
+    mu_shm_worker workers[];
+};
+
+struct mu_publisher
+{
+    mu_mule *mule;
+    thrd_t thread;
+    mtx_t lock;
+    cnd_t wake;
+    int running;
+    uint64_t interval_ns;
+    mu_shm_page *page;
+    size_t map_size;
+    mu_worker_stats *workers;
+    char path[256];
+};
+
+static const char mumule_shm_magic[8] = { 'M', 'U', 'S', 'T', 'A', 'T', 0, 1 };
+
+/*
+ * hardware counters:
+ *
+ * with `mumule_stats_perf` set before mule_start, each worker opens user
+ * space cycle, instruction, last-level cache miss and branch miss counters
+ * on itself with perf_event_open. the counters only run while the worker
+ * is scheduled, are read from any thread under the host mutex, scaled for
+ * multiplexing, and carried across restarts. when perf_event_paranoid, a
+ * seccomp filter or missing hardware refuses a counter it reads as zero,
+ * and `mule_perf` returns -1 if no counter could be opened at all. divided
+ * by the items of an epoch they give IPC and misses per item.
+ */
+
+enum {
+    mumule_perf_cycles,
+    mumule_perf_instructions,
+    mumule_perf_llc_misses,
+    mumule_perf_branch_misses,
+    mumule_perf_count,
+};
+
+struct mu_perf_counters
+{
+    uint64_t cycles;
+    uint64_t instructions;
+    uint64_t llc_misses;
+    uint64_t branch_misses;
+};
+
+/*
+ * sync epoch reports:
+ *
+ * with `mumule_stats_epoch` an epoch opens at the first `mule_submit`
+ * after a sync, which snapshots the per-worker counters, and closes in
+ * `mule_sync`, which diffs them into a report readable with
+ * `mule_epoch_report`. the first worker that finishes an item and finds
+ * every item of the queue claimed marks the first idle time, so the
+ * report shows how long the dispatcher waited on the tail after capacity
+ * started going unused. a high `imbalance` with a long `idle_wait_ns`
+ * calls for smaller grains or dynamic scheduling, a low `utilization`
+ * with balanced workers points at submit and wake overhead. worker
+ * counters are those of the host, so on arenas they include items of
+ * other arenas run during the epoch.
+ *
+ * - `items` - items completed in the epoch on this queue
+ * - `wall_ns` - first submit to the end of mule_sync
+ * - `idle_wait_ns` - first idle worker to the end of mule_sync
+ * - `busy_ns`, `max_busy_ns` - total and slowest worker kernel time
+ * - `imbalance` - max over mean worker busy time, 1.0 is balanced
+ * - `utilization` - busy time over wall time times workers
+ * - `perf` - hardware counters with `mumule_stats_perf` if `perf_valid`
+ */
+
+struct mu_worker_epoch
+{
+    uint64_t items;
+    uint64_t busy_ns;
+    mu_perf_counters perf;
+};
+
+struct mu_epoch_report
+{
+    uint64_t epoch;
+    uint64_t items;
+    uint64_t wall_ns;
+    uint64_t idle_wait_ns;
+    uint64_t busy_ns;
+    uint64_t max_busy_ns;
+    double imbalance;
+    double utilization;
+    size_t num_threads;
+    int perf_valid;
+    mu_perf_counters perf;
+};
+
+/* lock serializes epoch open and close and guards the buffers and report */
+struct mu_epoch
+{
+    _Atomic(uint64_t) start_ns;
+    _Atomic(uint64_t) first_idle_ns;
+    uint64_t base_processed;
+    mtx_t lock;
+    mu_epoch_report report;
+    mu_worker_stats *base;
+    mu_perf_counters *perf_base;
+    mu_worker_epoch *workers;
+    mu_worker_stats *stats;
+    mu_perf_counters *perf;
+};
+
+/*
+ * watchdog:
+ *
+ * `mule_watchdog` starts a thread that checks the item each worker is
+ * running. while the watchdog is enabled workers publish the queue, index
+ * and start time of their current item and keep their last few kernel
+ * durations. an item is reported once through the callback when it has
+ * been running longer than `threshold_ns`, or longer than `median_factor`
+ * times the median recent duration across workers; either limit may be
+ * zero. the callback runs on the watchdog thread, so kernels that block
+ * on i/o or spin on pathological inputs are named with their thread and
+ * item index even while mule_sync is still waiting for them. the default
+ * callback logs the straggler to stderr.
+ */
+
+enum {
+    mumule_watchdog_recent = 16,
+    mumule_watchdog_min_samples = 8,
+    mumule_watchdog_interval_ns = 10000000, /* 10 milliseconds */
+};
+
+struct mu_straggler
+{
+    mu_mule *queue;
+    size_t thr_idx;
+    size_t item_idx;
+    uint64_t elapsed_ns;
+    uint64_t median_ns;
+};
+
+struct mu_watchdog
+{
+    mu_mule *mule;
+    thrd_t thread;
+    mtx_t lock;
+    cnd_t wake;
+    int running;
+    uint64_t threshold_ns;
+    double median_factor;
+    uint64_t interval_ns;
+    mumule_straggler_fn fn;
+    void *arg;
+    uint64_t *reported;
+    uint64_t *samples;
+};
+
+/*
+ * recording:
+ *
+ * `mule_record_config` records the duration of each of the next
+ * `max_items` items of a queue by item index, and the time and size of
+ * each submit and the end of each sync. `mule_record_write` writes the
+ * recording as text for `mulesim`, which replays the submission pattern
+ * and durations through a model of the claim and wake logic with other
+ * thread counts, grain sizes and policies. durations are stored by the
+ * worker that ran the item without synchronization beyond the item claim;
+ * write the recording after mule_sync.
+ *
+ *     mumule-record 1
+ *     threads <n>
+ *     submit <ns> <count>
+ *     sync <ns>
+ *     items <n>
+ *     <duration ns>
+ */
+
+enum {
+    mumule_record_submit,
+    mumule_record_sync,
+};
+
+struct mu_record_event
+{
+    uint64_t type;
+    uint64_t time_ns;
+    uint64_t count;
+};
+
+struct mu_recorder
+{
+    mtx_t lock;
+    size_t base;
+    size_t max_items;
+    uint64_t *ticks;
+    mu_record_event *events;
+    size_t num_events;
+    size_t max_events;
+};
+
+struct mu_thread
+{
+    mu_mule *mule;
+    size_t idx;
+    thrd_t thread;
+    _Atomic(size_t) epoch;
+    _Atomic(int) parked;
+    _Atomic(uint64_t) item_start_ns;
+    _Atomic(size_t) item_idx;
+    _Atomic(mu_mule*) item_queue;
+    _Atomic(uint64_t) recent_ns[mumule_watchdog_recent];
+    size_t recent_pos;
+    int perf_fd[mumule_perf_count];
+    uint64_t perf_total[mumule_perf_count];
+    mu_scratch scratch;
+    pthread_t pthread;
+    void *stack;
+    size_t stack_map_size;
+    mu_thread_hist *hist;
+    mu_trace_ring *trace;
+    ALIGNED(64) mu_counters counters;
 };
 
-struct mu_thread { mu_mule *mule; size_t idx; thrd_t thread; };
+/*
+ * arenas:
+ *
+ * an arena is a mu_mule initialized with zero threads and attached to a
+ * host mule with `mule_attach`. the arena has its own kernel, userdata,
+ * counters and concurrency limit, and `mule_submit`, `mule_sync` and
+ * `mule_reset` work on it as they do on any other mule, but its items are
+ * run by the threads of the host. idle host workers serve the host queue
+ * first, then scan the attached arenas for work, so several independent
+ * queues can share one set of threads without oversubscribing the machine.
+ *
+ * workers bump their `epoch` to odd while scanning arenas and back to even
+ * when done. `mule_detach` clears the arena slot then waits for any worker
+ * with an odd epoch to move on before it returns, after which the arena
+ * can be destroyed safely.
+ */
 
 struct mu_mule
 {
@@ -108,13 +823,71 @@ struct mu_mule
     _Atomic(size_t)  running;
     _Atomic(size_t)  threads_running;
 
-    mu_thread        threads[mumule_max_threads];
+    _Atomic(size_t)  stopping;
+    int              lazy_start;
+
+    mu_mule*         host;
+    size_t           max_concurrency;
+    _Atomic(size_t)  concurrency;
+    _Atomic(mu_mule*) arenas[mumule_max_arenas];
+
+    mu_thread*       threads;
+    mu_thread_attr   thread_attr;
+
+    size_t           scratch_block_size;
+    int              scratch_flags;
+    _Atomic(size_t)  scratch_epoch;
+
+    int              stats_flags;
+    _Atomic(uint64_t) syncs;
+    _Atomic(uint64_t) sync_waits;
+    _Atomic(uint64_t) sync_timeouts;
+    _Atomic(uint64_t) submit_ticks;
+
+    mu_trace_ring*   trace;
+    mu_publisher*    publisher;
+    mu_epoch*        epoch;
+    mu_watchdog*     watchdog;
+    _Atomic(int)     watchdog_on;
+    mu_recorder*     record;
+    uint64_t         trace_base;
 
     ALIGNED(64) _Atomic(size_t)  queued;
     ALIGNED(64) _Atomic(size_t)  processing;
     ALIGNED(64) _Atomic(size_t)  processed;
 };
 
+/*
+ * shared pool:
+ *
+ * a process-wide host mule that components attach arenas to with
+ * `mule_shared_attach` and detach from with `mule_shared_detach`. the
+ * pool is sized to the number of online processors. threads are created
+ * by the first `mule_submit` to an attached arena, not at attach, and are
+ * stopped again when the last arena detaches, so processes that never
+ * submit work pay nothing. the pool is a weak definition so that every
+ * translation unit and library including this header shares one copy.
+ * compilers without weak symbols need it defined once in the program:
+ *
+ *     mu_shared mule_shared = MU_SHARED_INIT;
+ */
+
+struct mu_shared
+{
+    once_flag        once;
+    mtx_t            lock;
+    size_t           refcount;
+    mu_mule          mule;
+};
+
+#define MU_SHARED_INIT { ONCE_FLAG_INIT }
+
+#if defined(__GNUC__)
+__attribute__((weak)) mu_shared mule_shared = MU_SHARED_INIT;
+#else
+extern mu_shared mule_shared;
+#endif
+
 /*
  * mumule implementation
  */
@@ -127,6 +900,48 @@ static inline struct timespec _timespec_add(struct timespec abstime, llong relti
     return abstime;
 }
 
+static inline uint64_t _mule_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t _mule_ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return _mule_now_ns();
+#endif
+}
+
+static double _mule_ns_per_tick_value = 1.0;
+static once_flag _mule_ns_per_tick_once = ONCE_FLAG_INIT;
+
+static void _mule_ns_per_tick_calibrate()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint64_t n0 = _mule_now_ns(), t0 = _mule_ticks(), n1, t1;
+    do { n1 = _mule_now_ns(); t1 = _mule_ticks(); } while (n1 - n0 < 2000000);
+    _mule_ns_per_tick_value = (double)(n1 - n0) / (double)(t1 - t0);
+#endif
+}
+
+/* calibrate ticks against the monotonic clock once, on first use */
+static double _mule_ns_per_tick()
+{
+    call_once(&_mule_ns_per_tick_once, _mule_ns_per_tick_calibrate);
+    return _mule_ns_per_tick_value;
+}
+
+/* single-writer counter update, no locked read-modify-write needed */
+static inline void _mule_count(_Atomic(uint64_t) *counter, uint64_t value)
+{
+    atomic_store_explicit(counter, atomic_load_explicit(counter,
+        __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
 static inline const char* _timespec_string(char *buf, size_t buf_size, struct timespec abstime)
 {
     struct tm ttm;
@@ -143,75 +958,217 @@ static void mule_init(mu_mule *mule, size_t num_threads, mumule_work_fn kernel,
     mule->userdata = userdata;
     mule->kernel = kernel;
     mule->num_threads = num_threads;
+    if (num_threads) {
+        assert(num_threads <= mumule_max_threads);
+        size_t threads_size = num_threads * sizeof(mu_thread);
+        assert((mule->threads = (mu_thread*)aligned_alloc(64, threads_size)));
+        memset(mule->threads, 0, threads_size);
+        for (size_t i = 0; i < num_threads; i++) {
+            for (size_t k = 0; k < mumule_perf_count; k++) mule->threads[i].perf_fd[k] = -1;
+        }
+    }
     mtx_init(&mule->mutex, mtx_plain);
     cnd_init(&mule->wake_worker);
     cnd_init(&mule->wake_dispatcher);
 }
 
-static int mule_thread(void *arg)
+static inline mu_mule* _mule_host(mu_mule *mule)
 {
-    mu_thread *thread = (mu_thread*)arg;
-    mu_mule *mule = thread->mule;
-    void* userdata = mule->userdata;
-    const size_t thread_idx = thread->idx;
-    size_t queued, processing, processed, workitem_idx;
-    char tstr[32];
+    return mule->host ? mule->host : mule;
+}
 
-    debugf("mule_thread-%zu: worker-started\n", thread_idx);
-    atomic_fetch_add_explicit(&mule->threads_running, 1, __ATOMIC_RELAXED);
+static inline void _mule_scratch_rewind(mu_scratch *scratch)
+{
+    scratch->cur = scratch->head;
+    if (scratch->head) scratch->head->used = 0;
+}
 
-    for (;;) {
-        struct timespec abstime = { 0 };
-        assert(!clock_gettime(CLOCK_REALTIME, &abstime));
-        abstime = _timespec_add(abstime, mumule_revalidate_work_available_ns);
+static void _mule_scratch_free(mu_scratch *scratch)
+{
+    mu_scratch_block *b = scratch->head, *next;
+    while (b) {
+        next = b->next;
+        munmap(b, b->map_size);
+        b = next;
+    }
+    memset(scratch, 0, sizeof(mu_scratch));
+}
 
-        /* find out how many items still need processing */
-        queued = atomic_load_explicit(&mule->queued, __ATOMIC_ACQUIRE);
-        processing = atomic_load_explicit(&mule->processing, __ATOMIC_ACQUIRE);
+/* bucket of `v`, exact below the sub-bucket count then log-linear */
+static inline size_t _mule_hist_bucket(uint64_t v)
+{
+    if (v < mumule_hist_sub_count) return (size_t)v;
+    size_t mag = 63 - (size_t)__builtin_clzll(v);
+    size_t sub = (size_t)(v >> (mag - mumule_hist_sub_bits)) & (mumule_hist_sub_count - 1);
+    return (mag - mumule_hist_sub_bits + 1) * mumule_hist_sub_count + sub;
+}
 
-        /* sleep on condition if queue empty or exit if asked to stop */
-        if (processing == queued)
-        {
-            tracef("mule_thread-%zu: queue-empty (t=%s)\n",
-                thread_idx, _timespec_string(tstr, sizeof(tstr), abstime));
-
-            mtx_lock(&mule->mutex);
-            if (!atomic_load(&mule->running)) {
-                mtx_unlock(&mule->mutex);
-                break;
-            }
+/* largest value that lands in bucket `i` */
+static inline uint64_t _mule_hist_bucket_value(size_t i)
+{
+    if (i < mumule_hist_sub_count) return i;
+    size_t mag = i / mumule_hist_sub_count + mumule_hist_sub_bits - 1;
+    size_t sub = i % mumule_hist_sub_count;
+    uint64_t lo = (uint64_t)(mumule_hist_sub_count + sub) << (mag - mumule_hist_sub_bits);
+    return lo + (((uint64_t)1 << (mag - mumule_hist_sub_bits)) - 1);
+}
 
-            /*
-             * +
-             * |
-             * | [queue-empty] -> [queue-processing]
-             * |
-             * | [worker-lost-wakeup] condition change missed by
-             * | the worker if pre-empted before cnd_wait so we
-             * | use cond_timedwait and loop to recheck the condition.
-             *  \
-             *   +
-             */
-            tracef("mule_thread-%zu: queue-empty\n", thread_idx);
-            cnd_timedwait(&mule->wake_worker, &mule->mutex, &abstime);
-            tracef("mule_thread-%zu: worker-woke\n", thread_idx);
-            mtx_unlock(&mule->mutex);
+static inline void _mule_hist_record(mu_hist *h, uint64_t v)
+{
+    uint64_t count = atomic_load_explicit(&h->count, __ATOMIC_RELAXED);
+    if (!count || v < atomic_load_explicit(&h->min, __ATOMIC_RELAXED)) {
+        atomic_store_explicit(&h->min, v, __ATOMIC_RELAXED);
+    }
+    if (v > atomic_load_explicit(&h->max, __ATOMIC_RELAXED)) {
+        atomic_store_explicit(&h->max, v, __ATOMIC_RELAXED);
+    }
+    _mule_count(&h->buckets[_mule_hist_bucket(v)], 1);
+    _mule_count(&h->sum, v);
+    atomic_store_explicit(&h->count, count + 1, __ATOMIC_RELEASE);
+}
 
-            continue;
+/* owner-only insert into the top-N, readers retry on odd or moved seq */
+static inline void _mule_slowest_record(mu_slowest *s, uint64_t ticks, size_t item_idx)
+{
+    if (ticks <= atomic_load_explicit(&s->ticks[s->lowest], __ATOMIC_RELAXED)) return;
+
+    uint32_t seq = atomic_load_explicit(&s->seq, __ATOMIC_RELAXED);
+    atomic_store_explicit(&s->seq, seq + 1, __ATOMIC_RELAXED);
+    atomic_thread_fence(__ATOMIC_RELEASE);
+    atomic_store_explicit(&s->ticks[s->lowest], ticks, __ATOMIC_RELAXED);
+    atomic_store_explicit(&s->item_idx[s->lowest], item_idx, __ATOMIC_RELAXED);
+    atomic_store_explicit(&s->seq, seq + 2, __ATOMIC_RELEASE);
+
+    for (uint32_t i = 0; i < mumule_slowest_items; i++) {
+        if (atomic_load_explicit(&s->ticks[i], __ATOMIC_RELAXED) <
+            atomic_load_explicit(&s->ticks[s->lowest], __ATOMIC_RELAXED)) {
+            s->lowest = i;
         }
+    }
+}
+
+/* record an event; worker rings have one writer, the host ring several */
+static inline void _mule_trace_emit(mu_trace_ring *ring, uint64_t type,
+    uint64_t ticks, uint64_t dur, uint64_t arg)
+{
+    size_t i = atomic_fetch_add_explicit(&ring->head, 1, __ATOMIC_RELAXED) & ring->mask;
+    mu_trace_event *e = &ring->events[i];
+    e->ticks = ticks;
+    e->dur = dur;
+    e->arg = arg;
+    e->type = type;
+}
+
+static inline int _mule_trace_sample(mu_trace_ring *ring)
+{
+    if (!ring || --ring->countdown) return 0;
+    ring->countdown = ring->sample_rate;
+    return 1;
+}
+
+/*
+ * a worker that read `queued` before a concurrent mule_reset and
+ * `processing` after it can claim an item past the end of the reset queue.
+ * such a claim is handed back, after any stale claims stacked on top of it,
+ * unless the queue has grown to cover the item in the meantime.
+ */
+static int _mule_claim_valid(mu_mule *q, size_t workitem_idx)
+{
+    for (;;) {
+        if (workitem_idx <= atomic_load_explicit(&q->queued, __ATOMIC_ACQUIRE)) return 1;
+        size_t expected = workitem_idx, prev = workitem_idx - 1;
+        if (atomic_compare_exchange_strong(&q->processing, &expected, prev)) return 0;
+        /* reset again, the claim is already gone */
+        if (expected < workitem_idx) return 0;
+        thrd_yield();
+    }
+}
+
+/*
+ * claim and run one work-item from queue `q` on `thread`. returns zero if
+ * the queue is empty or the arena is at its concurrency limit, otherwise
+ * returns non-zero if an item was run or if the claim raced another worker.
+ */
+static int _mule_run_one(mu_mule *q, mu_thread *thread)
+{
+    mu_counters *counters = &thread->counters;
+    size_t queued, processing, processed, workitem_idx;
+    uint64_t t0 = 0;
 
-        /* dequeue work-item using compare-and-swap, run, update processed */
-        workitem_idx = processing + 1;
-        if (!atomic_compare_exchange_weak(&mule->processing, &processing,
-            workitem_idx)) continue;
+    /* find out how many items still need processing */
+    queued = atomic_load_explicit(&q->queued, __ATOMIC_ACQUIRE);
+    processing = atomic_load_explicit(&q->processing, __ATOMIC_ACQUIRE);
+    if (processing == queued) return 0;
+
+    /* arenas limit the number of host workers running their kernel */
+    if (q->max_concurrency && atomic_fetch_add_explicit(&q->concurrency, 1,
+            __ATOMIC_ACQUIRE) >= q->max_concurrency) {
+        atomic_fetch_sub_explicit(&q->concurrency, 1, __ATOMIC_RELEASE);
+        return 0;
+    }
+
+    /* decide on sampling before the claim so the claim span is covered */
+    const int sampled = _mule_trace_sample(thread->trace);
+    uint64_t tc = sampled ? _mule_ticks() : 0;
+    MULE_FAULT(claim);
+
+    /* dequeue work-item using compare-and-swap, run, update processed */
+    workitem_idx = processing + 1;
+    if (atomic_compare_exchange_weak(&q->processing, &processing, workitem_idx) &&
+        _mule_claim_valid(q, workitem_idx))
+    {
+        mu_thread_hist *hist = thread->hist;
+        const int timed = (thread->mule->stats_flags & mumule_stats_time) ||
+            hist || sampled || q->epoch || q->record;
+        const int watched = atomic_load_explicit(&thread->mule->watchdog_on, __ATOMIC_RELAXED);
+        uint64_t w0 = 0;
+        if (watched) {
+            w0 = _mule_now_ns();
+            atomic_store_explicit(&thread->item_queue, q, __ATOMIC_RELAXED);
+            atomic_store_explicit(&thread->item_idx, workitem_idx, __ATOMIC_RELAXED);
+            atomic_store_explicit(&thread->item_start_ns, w0, __ATOMIC_RELEASE);
+        }
+        if (timed) t0 = _mule_ticks();
         atomic_thread_fence(__ATOMIC_ACQUIRE);
-        (mule->kernel)(userdata, thread_idx, workitem_idx);
+        MULE_PROBE3(item__begin, q, thread->idx, workitem_idx);
+        (q->kernel)(q->userdata, thread->idx, workitem_idx);
+        MULE_PROBE3(item__end, q, thread->idx, workitem_idx);
         atomic_thread_fence(__ATOMIC_RELEASE);
-        processed = atomic_fetch_add_explicit(&mule->processed, 1, __ATOMIC_SEQ_CST);
+        if (watched) {
+            atomic_store_explicit(&thread->item_start_ns, 0, __ATOMIC_RELEASE);
+            atomic_store_explicit(&thread->recent_ns[thread->recent_pos++ %
+                mumule_watchdog_recent], _mule_now_ns() - w0 + 1, __ATOMIC_RELAXED);
+        }
+        if (timed) {
+            uint64_t t1 = _mule_ticks();
+            _mule_count(&counters->busy_ticks, t1 - t0);
+            if (q->record && workitem_idx - q->record->base - 1 < q->record->max_items) {
+                q->record->ticks[workitem_idx - q->record->base - 1] = t1 - t0 + 1;
+            }
+            if (hist) {
+                uint64_t submitted = atomic_load_explicit(&q->submit_ticks, __ATOMIC_RELAXED);
+                _mule_hist_record(&hist->kernel, t1 - t0);
+                _mule_hist_record(&hist->delay, t0 > submitted ? t0 - submitted : 0);
+                _mule_slowest_record(&hist->slowest, t1 - t0, workitem_idx);
+            }
+            if (sampled) {
+                _mule_trace_emit(thread->trace, mumule_trace_claim, tc, t0 - tc, workitem_idx);
+                _mule_trace_emit(thread->trace, mumule_trace_item, t0, t1 - t0, workitem_idx);
+            }
+        }
+        _mule_count(&counters->items, 1);
+        processed = atomic_fetch_add_explicit(&q->processed, 1, __ATOMIC_SEQ_CST);
+
+        /* first worker to run out of items marks the start of the tail */
+        if (q->epoch && atomic_load_explicit(&q->processing, __ATOMIC_RELAXED) ==
+                atomic_load_explicit(&q->queued, __ATOMIC_RELAXED)) {
+            uint64_t none = 0;
+            atomic_compare_exchange_strong(&q->epoch->first_idle_ns, &none, _mule_now_ns());
+        }
 
         /* signal dispatcher precisely when the last item is processed */
         if (processed + 1 == queued) {
-            tracef("mule_thread-%zu: queue-complete\n", thread_idx);
+            mu_tracef(mu_log_cat_worker, "mule_thread-%zu: queue-complete\n", thread->idx);
             /*
              *   +
              *  /
@@ -223,33 +1180,439 @@ static int mule_thread(void *arg)
              * |
              * +
              */
-            cnd_signal(&mule->wake_dispatcher);
+            cnd_signal(&q->wake_dispatcher);
+        }
+    } else {
+        _mule_count(&counters->cas_failures, 1);
+        MULE_PROBE3(claim__fail, q, thread->idx, workitem_idx);
+        if (sampled) {
+            _mule_trace_emit(thread->trace, mumule_trace_claim_lost, tc, 0, workitem_idx);
         }
     }
 
+    if (q->max_concurrency) {
+        atomic_fetch_sub_explicit(&q->concurrency, 1, __ATOMIC_RELEASE);
+    }
+
+    return 1;
+}
+
+/*
+ * scan attached arenas for work, starting at a slot offset by the thread
+ * index so that idle workers spread themselves across busy arenas.
+ */
+static int _mule_run_arenas(mu_mule *mule, mu_thread *thread)
+{
+    int ran = 0;
+
+    atomic_fetch_add_explicit(&thread->epoch, 1, __ATOMIC_SEQ_CST);
+    for (size_t i = 0; i < mumule_max_arenas && !ran; i++) {
+        size_t slot = (thread->idx + i) % mumule_max_arenas;
+        mu_mule *arena = atomic_load_explicit(&mule->arenas[slot], __ATOMIC_SEQ_CST);
+        if (arena) ran = _mule_run_one(arena, thread);
+    }
+    atomic_fetch_add_explicit(&thread->epoch, 1, __ATOMIC_SEQ_CST);
+
+    return ran;
+}
+
+/*
+ * apply thread name and scheduling class from within the worker itself
+ */
+static void _mule_thread_setup(mu_thread *thread)
+{
+#if defined(__linux__)
+    const mu_thread_attr *attr = &thread->mule->thread_attr;
+    struct sched_param param = { 0 };
+    char name[16];
+
+    if (attr->name) {
+        snprintf(name, sizeof(name), "%s-%zu", attr->name, thread->idx);
+        prctl(PR_SET_NAME, name, 0, 0, 0);
+    }
+    switch (attr->sched) {
+    case mumule_sched_batch: sched_setscheduler(0, SCHED_BATCH, &param); break;
+    case mumule_sched_idle: sched_setscheduler(0, SCHED_IDLE, &param); break;
+    default: break;
+    }
+    if (attr->affinity == mumule_affinity_compact) {
+        /* raw syscalls avoid depending on _GNU_SOURCE for cpu_set_t */
+        unsigned long allowed[16] = { 0 }, mask[16] = { 0 };
+        const size_t bits = sizeof(unsigned long) * 8;
+        long len = syscall(SYS_sched_getaffinity, 0, sizeof(allowed), allowed);
+        size_t ncpu = 0, n;
+        for (size_t cpu = 0; len > 0 && cpu < (size_t)len * 8; cpu++) {
+            ncpu += (allowed[cpu / bits] >> (cpu % bits)) & 1;
+        }
+        n = ncpu ? thread->idx % ncpu : 0;
+        for (size_t cpu = 0; ncpu && cpu < (size_t)len * 8; cpu++) {
+            if (((allowed[cpu / bits] >> (cpu % bits)) & 1) && n-- == 0) {
+                mask[cpu / bits] = 1ul << (cpu % bits);
+                syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask);
+                break;
+            }
+        }
+    }
+#endif
+}
+
+/* open counters on the calling worker, unavailable counters stay at -1 */
+static void _mule_perf_open(mu_thread *thread)
+{
+#if defined(MULE_HAVE_PERF)
+    static const uint64_t config[mumule_perf_count] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES,
+    };
+    int fd[mumule_perf_count];
+    for (size_t k = 0; k < mumule_perf_count; k++) {
+        struct perf_event_attr pe;
+        memset(&pe, 0, sizeof(pe));
+        pe.size = sizeof(pe);
+        pe.type = PERF_TYPE_HARDWARE;
+        pe.config = config[k];
+        pe.exclude_kernel = 1;
+        pe.exclude_hv = 1;
+        pe.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        fd[k] = (int)syscall(SYS_perf_event_open, &pe, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        if (fd[k] < 0) {
+            mu_debugf(mu_log_cat_worker, "mule_thread-%zu: perf-unavailable (counter=%zu)\n",
+                thread->idx, k);
+        }
+    }
+    /* publish under the mutex, mule_perf may be reading the other workers */
+    mtx_lock(&thread->mule->mutex);
+    memcpy(thread->perf_fd, fd, sizeof(fd));
+    mtx_unlock(&thread->mule->mutex);
+#endif
+}
+
+/* counters of a worker, returns the number of counters open, mutex held */
+static int _mule_perf_read(mu_thread *thread, uint64_t value[mumule_perf_count])
+{
+    int open = 0;
+    for (size_t k = 0; k < mumule_perf_count; k++) {
+        uint64_t buf[3];
+        value[k] = thread->perf_total[k];
+        if (thread->perf_fd[k] < 0) continue;
+        open++;
+        if (read(thread->perf_fd[k], buf, sizeof(buf)) != sizeof(buf) || !buf[2]) continue;
+        value[k] += buf[2] < buf[1] ? (uint64_t)((double)buf[0] * buf[1] / buf[2]) : buf[0];
+    }
+    return open;
+}
+
+/* fold the final counts into the totals and close after the worker exits, mutex held */
+static void _mule_perf_close(mu_thread *thread)
+{
+    _mule_perf_read(thread, thread->perf_total);
+    for (size_t k = 0; k < mumule_perf_count; k++) {
+        if (thread->perf_fd[k] >= 0) close(thread->perf_fd[k]);
+        thread->perf_fd[k] = -1;
+    }
+}
+
+static void _mule_perf_counters(mu_perf_counters *c, const uint64_t value[mumule_perf_count])
+{
+    c->cycles = value[mumule_perf_cycles];
+    c->instructions = value[mumule_perf_instructions];
+    c->llc_misses = value[mumule_perf_llc_misses];
+    c->branch_misses = value[mumule_perf_branch_misses];
+}
+
+static int mule_thread(void *arg)
+{
+    mu_thread *thread = (mu_thread*)arg;
+    mu_mule *mule = thread->mule;
+    const size_t thread_idx = thread->idx;
+    char tstr[32];
+
+    _mule_thread_setup(thread);
+    if (mule->stats_flags & mumule_stats_perf) _mule_perf_open(thread);
+
+    mu_debugf(mu_log_cat_worker, "mule_thread-%zu: worker-started\n", thread_idx);
+    atomic_fetch_add_explicit(&mule->threads_running, 1, __ATOMIC_RELAXED);
+
+    for (;;) {
+        /* release scratch in bulk when the epoch advances between items */
+        size_t scratch_epoch = atomic_load_explicit(&mule->scratch_epoch, __ATOMIC_RELAXED);
+        if (thread->scratch.epoch != scratch_epoch) {
+            _mule_scratch_rewind(&thread->scratch);
+            thread->scratch.epoch = scratch_epoch;
+        }
+
+        /* run items from our own queue, then from attached arenas */
+        if (_mule_run_one(mule, thread)) continue;
+        if (_mule_run_arenas(mule, thread)) continue;
+        MULE_FAULT(park);
+
+        struct timespec abstime = { 0 };
+        assert(!clock_gettime(CLOCK_REALTIME, &abstime));
+        abstime = _timespec_add(abstime, mumule_revalidate_work_available_ns);
+
+        /* sleep on condition if queue empty or exit if asked to stop */
+        mu_tracef(mu_log_cat_worker, "mule_thread-%zu: queue-empty (t=%s)\n",
+            thread_idx, _timespec_string(tstr, sizeof(tstr), abstime));
+
+        mtx_lock(&mule->mutex);
+        if (!atomic_load(&mule->running)) {
+            mtx_unlock(&mule->mutex);
+            break;
+        }
+
+        /*
+         * +
+         * |
+         * | [queue-empty] -> [queue-processing]
+         * |
+         * | [worker-lost-wakeup] condition change missed by
+         * | the worker if pre-empted before cnd_wait so we
+         * | use cond_timedwait and loop to recheck the condition.
+         *  \
+         *   +
+         */
+        mu_tracef(mu_log_cat_worker, "mule_thread-%zu: queue-empty\n", thread_idx);
+        uint64_t t0 = _mule_now_ns(), tp = thread->trace ? _mule_ticks() : 0;
+        MULE_PROBE2(park, mule, thread_idx);
+        atomic_store_explicit(&thread->parked, 1, __ATOMIC_RELAXED);
+        int ret = cnd_timedwait(&mule->wake_worker, &mule->mutex, &abstime);
+        atomic_store_explicit(&thread->parked, 0, __ATOMIC_RELAXED);
+        MULE_PROBE3(wake, mule, thread_idx, ret == thrd_timedout);
+        mu_tracef(mu_log_cat_worker, "mule_thread-%zu: worker-woke\n", thread_idx);
+        mtx_unlock(&mule->mutex);
+
+        if (thread->trace) {
+            _mule_trace_emit(thread->trace, mumule_trace_park, tp,
+                _mule_ticks() - tp, ret == thrd_timedout);
+        }
+
+        _mule_count(&thread->counters.park_ns, _mule_now_ns() - t0);
+        _mule_count(&thread->counters.parks, 1);
+        _mule_count(ret == thrd_timedout ? &thread->counters.wake_timeouts
+            : &thread->counters.wake_signals, 1);
+    }
+
     atomic_fetch_add_explicit(&mule->threads_running, -1, __ATOMIC_RELAXED);
-    debugf("mule_thread-%zu: worker-exiting\n", thread_idx);
+    mu_debugf(mu_log_cat_worker, "mule_thread-%zu: worker-exiting\n", thread_idx);
 
     return 0;
 }
 
+static void* _mule_pthread_start(void *arg)
+{
+    mule_thread(arg);
+    return NULL;
+}
+
+/*
+ * map `size` bytes so that `offset` bytes in is aligned to `align`, a power
+ * of two page multiple. mmap only guarantees page alignment, so map `align`
+ * bytes extra and trim either end. returns MAP_FAILED on failure.
+ */
+static void* _mule_map_aligned(size_t size, size_t align, size_t offset, int flags)
+{
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    char *p, *q;
+
+    if (align <= page_size) {
+        return mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    }
+    p = (char*)mmap(NULL, size + align, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (p == MAP_FAILED) return MAP_FAILED;
+    q = (char*)((((uintptr_t)p + offset + align - 1) & ~(uintptr_t)(align - 1)) - offset);
+    if (q > p) munmap(p, (size_t)(q - p));
+    munmap(q + size, (size_t)(p + align - q));
+
+    return q;
+}
+
+/*
+ * map a worker stack with a guard page below it and start the worker on
+ * it with pthreads. workers with default attributes use thrd_create.
+ * huge page stacks are rounded to and aligned on 2 MiB.
+ */
+static int _mule_thread_create_stack(mu_mule *mule, mu_thread *thread)
+{
+    const mu_thread_attr *attr = &mule->thread_attr;
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t align = attr->stack_flags & mumule_stack_hugepages
+        ? mumule_scratch_huge_page_size : page_size;
+    size_t stack_size = (attr->stack_size + align - 1) & ~(align - 1);
+    int map_flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    pthread_attr_t pattr;
+    char *p;
+    int ret;
+
+#if defined(MAP_STACK)
+    map_flags |= MAP_STACK;
+#endif
+#if defined(MAP_POPULATE)
+    if (attr->stack_flags & mumule_stack_prefault) map_flags |= MAP_POPULATE;
+#endif
+
+    p = (char*)_mule_map_aligned(stack_size + page_size, align, page_size, map_flags);
+    if (p == MAP_FAILED) return -1;
+    mprotect(p, page_size, PROT_NONE);
+#if defined(MADV_HUGEPAGE)
+    if (attr->stack_flags & mumule_stack_hugepages) {
+        madvise(p + page_size, stack_size, MADV_HUGEPAGE);
+    }
+#endif
+#if !defined(MAP_POPULATE)
+    if (attr->stack_flags & mumule_stack_prefault) {
+        for (size_t o = page_size; o < stack_size + page_size; o += page_size) p[o] = 0;
+    }
+#endif
+
+    thread->stack = p;
+    thread->stack_map_size = stack_size + page_size;
+
+    pthread_attr_init(&pattr);
+    pthread_attr_setstack(&pattr, p + page_size, stack_size);
+    ret = pthread_create(&thread->pthread, &pattr, _mule_pthread_start, thread);
+    pthread_attr_destroy(&pattr);
+
+    if (ret) {
+        munmap(thread->stack, thread->stack_map_size);
+        thread->stack = NULL;
+    }
+
+    return ret;
+}
+
+/* open an epoch at the first submit after a sync, before items are queued */
+static void _mule_epoch_open(mu_mule *mule, size_t queued)
+{
+    mu_epoch *epoch = mule->epoch;
+    mu_stats stats;
+
+    mtx_lock(&epoch->lock);
+    if (!atomic_load_explicit(&epoch->start_ns, __ATOMIC_RELAXED)) {
+        mule_stats(mule, &stats, epoch->base);
+        mule_perf(mule, NULL, epoch->perf_base);
+        epoch->base_processed = queued;
+        atomic_store_explicit(&epoch->first_idle_ns, 0, __ATOMIC_RELAXED);
+        atomic_store_explicit(&epoch->start_ns, _mule_now_ns(), __ATOMIC_RELEASE);
+    }
+    mtx_unlock(&epoch->lock);
+}
+
+static void _mule_epoch_close(mu_mule *mule)
+{
+    mu_epoch *epoch = mule->epoch;
+    mu_epoch_report *r = &epoch->report;
+    mu_worker_stats *workers = epoch->stats;
+    mu_perf_counters *perf = epoch->perf;
+    mu_stats stats;
+    uint64_t end_ns = _mule_now_ns();
+
+    mtx_lock(&epoch->lock);
+    mule_stats(mule, &stats, workers);
+    int perf_valid = !mule_perf(mule, NULL, perf);
+    uint64_t start_ns = atomic_load_explicit(&epoch->start_ns, __ATOMIC_RELAXED);
+    uint64_t idle_ns = atomic_load_explicit(&epoch->first_idle_ns, __ATOMIC_RELAXED);
+    uint64_t processed = atomic_load_explicit(&mule->processed, __ATOMIC_RELAXED);
+    uint64_t max_items = 0, total_items = 0;
+
+    r->epoch++;
+    r->items = processed - epoch->base_processed;
+    r->wall_ns = end_ns - start_ns;
+    r->idle_wait_ns = idle_ns && idle_ns < end_ns ? end_ns - idle_ns : 0;
+    r->busy_ns = r->max_busy_ns = 0;
+    r->num_threads = stats.num_threads;
+    r->perf_valid = perf_valid;
+    memset(&r->perf, 0, sizeof(r->perf));
+    for (size_t i = 0; i < stats.num_threads; i++) {
+        mu_worker_epoch *w = &epoch->workers[i];
+        w->items = workers[i].items - epoch->base[i].items;
+        w->busy_ns = workers[i].busy_ns - epoch->base[i].busy_ns;
+        memset(&w->perf, 0, sizeof(w->perf));
+        if (perf_valid) {
+            w->perf.cycles = perf[i].cycles - epoch->perf_base[i].cycles;
+            w->perf.instructions = perf[i].instructions - epoch->perf_base[i].instructions;
+            w->perf.llc_misses = perf[i].llc_misses - epoch->perf_base[i].llc_misses;
+            w->perf.branch_misses = perf[i].branch_misses - epoch->perf_base[i].branch_misses;
+            r->perf.cycles += w->perf.cycles;
+            r->perf.instructions += w->perf.instructions;
+            r->perf.llc_misses += w->perf.llc_misses;
+            r->perf.branch_misses += w->perf.branch_misses;
+        }
+        r->busy_ns += w->busy_ns;
+        if (w->busy_ns > r->max_busy_ns) r->max_busy_ns = w->busy_ns;
+        total_items += w->items;
+        if (w->items > max_items) max_items = w->items;
+    }
+
+    /* fall back to item counts when kernels are too short to time */
+    r->imbalance = r->num_threads == 0 ? 1.0 : r->busy_ns ?
+        (double)r->max_busy_ns * r->num_threads / r->busy_ns :
+        total_items ? (double)max_items * r->num_threads / total_items : 1.0;
+    r->utilization = r->num_threads && r->wall_ns ?
+        (double)r->busy_ns / ((double)r->wall_ns * r->num_threads) : 0.0;
+    atomic_store_explicit(&epoch->start_ns, 0, __ATOMIC_RELEASE);
+    mtx_unlock(&epoch->lock);
+}
+
+static void _mule_record_event(mu_recorder *rec, uint64_t type, uint64_t count)
+{
+    mtx_lock(&rec->lock);
+    if (rec->num_events == rec->max_events) {
+        size_t n = rec->max_events ? rec->max_events * 2 : 256;
+        mu_record_event *events = (mu_record_event*)realloc(rec->events,
+            n * sizeof(mu_record_event));
+        if (events) {
+            rec->events = events;
+            rec->max_events = n;
+        }
+    }
+    if (rec->num_events < rec->max_events) {
+        mu_record_event e = { type, _mule_now_ns(), count };
+        rec->events[rec->num_events++] = e;
+    }
+    mtx_unlock(&rec->lock);
+}
+
 static size_t mule_submit(mu_mule *mule, size_t count)
 {
-    debugf("mule_submit: queue-start\n");
+    mu_mule *host = _mule_host(mule);
+
+    mu_debugf(mu_log_cat_submit, "mule_submit: queue-start\n");
+    if (host->stats_flags & mumule_stats_histogram) {
+        atomic_store_explicit(&mule->submit_ticks, _mule_ticks(), __ATOMIC_RELAXED);
+    }
+    if (host->trace) {
+        _mule_trace_emit(host->trace, mumule_trace_submit, _mule_ticks(), 0, count);
+    }
+    if (mule->epoch && !atomic_load_explicit(&mule->epoch->start_ns, __ATOMIC_ACQUIRE)) {
+        _mule_epoch_open(mule, atomic_load_explicit(&mule->queued, __ATOMIC_ACQUIRE));
+    }
+    if (mule->record) _mule_record_event(mule->record, mumule_record_submit, count);
     size_t idx = atomic_fetch_add_explicit(&mule->queued, count, __ATOMIC_SEQ_CST);
-    cnd_broadcast(&mule->wake_worker);
+    MULE_PROBE3(submit, mule, count, idx + count);
+    if (host->lazy_start && !atomic_load_explicit(&host->running, __ATOMIC_ACQUIRE)) {
+        mule_start(host);
+    }
+    cnd_broadcast(&host->wake_worker);
     return idx + count;
 }
 
 static int mule_start(mu_mule *mule)
 {
     mtx_lock(&mule->mutex);
+
+    /* wait for a concurrent mule_stop to finish joining its workers */
+    while (atomic_load(&mule->stopping)) {
+        mtx_unlock(&mule->mutex);
+        thrd_yield();
+        mtx_lock(&mule->mutex);
+    }
+
     if (atomic_load(&mule->running)) {
         mtx_unlock(&mule->mutex);
         return 0;
     }
 
-    debugf("mule_start: starting-threads\n");
+    mu_debugf(mu_log_cat_submit, "mule_start: starting-threads\n");
     for (size_t idx = 0; idx < mule->num_threads; idx++) {
         mule->threads[idx].mule = mule;
         mule->threads[idx].idx = idx;
@@ -258,7 +1621,11 @@ static int mule_start(mu_mule *mule)
     atomic_thread_fence(__ATOMIC_SEQ_CST);
 
     for (size_t i = 0; i < mule->num_threads; i++) {
-        assert(!thrd_create(&mule->threads[i].thread, mule_thread, &mule->threads[i]));
+        if (mule->thread_attr.stack_size) {
+            assert(!_mule_thread_create_stack(mule, &mule->threads[i]));
+        } else {
+            assert(!thrd_create(&mule->threads[i].thread, mule_thread, &mule->threads[i]));
+        }
     }
     mtx_unlock(&mule->mutex);
     return 0;
@@ -269,8 +1636,12 @@ static int mule_sync(mu_mule *mule)
     size_t queued, processed;
     char tstr[32];
 
-    debugf("mule_sync: quench-queue\n");
-    cnd_broadcast(&mule->wake_worker);
+    mu_debugf(mu_log_cat_sync, "mule_sync: quench-queue\n");
+    mu_trace_ring *trace = _mule_host(mule)->trace;
+    uint64_t ts = trace ? _mule_ticks() : 0;
+    atomic_fetch_add_explicit(&mule->syncs, 1, __ATOMIC_RELAXED);
+    MULE_PROBE2(sync__begin, mule, atomic_load_explicit(&mule->queued, __ATOMIC_RELAXED));
+    cnd_broadcast(&_mule_host(mule)->wake_worker);
 
     /* wait for queue to quench */
     mtx_lock(&mule->mutex);
@@ -293,17 +1664,35 @@ static int mule_sync(mu_mule *mule)
              *  \
              *   +
              */
-            tracef("mule_sync: queue-processing (t=%s)\n",
+            mu_tracef(mu_log_cat_sync, "mule_sync: queue-processing (t=%s)\n",
                 _timespec_string(tstr, sizeof(tstr), abstime));
-            cnd_timedwait(&mule->wake_dispatcher, &mule->mutex, &abstime);
-            tracef("mule_sync: dispatcher-woke\n");
+            MULE_FAULT(sync);
+            int ret = cnd_timedwait(&mule->wake_dispatcher, &mule->mutex, &abstime);
+            mu_tracef(mu_log_cat_sync, "mule_sync: dispatcher-woke\n");
+            atomic_fetch_add_explicit(&mule->sync_waits, 1, __ATOMIC_RELAXED);
+            if (ret == thrd_timedout) {
+                atomic_fetch_add_explicit(&mule->sync_timeouts, 1, __ATOMIC_RELAXED);
+            }
         } else {
             break;
         }
     };
     mtx_unlock(&mule->mutex);
 
-    debugf("mule_sync: queue-complete\n");
+    if (mule->scratch_flags & mumule_scratch_reset_on_sync) {
+        mule_scratch_reset(mule);
+    }
+
+    if (trace) {
+        _mule_trace_emit(trace, mumule_trace_sync, ts, _mule_ticks() - ts, queued);
+    }
+    MULE_PROBE2(sync__end, mule, queued);
+    if (mule->record) _mule_record_event(mule->record, mumule_record_sync, 0);
+    if (mule->epoch && atomic_load_explicit(&mule->epoch->start_ns, __ATOMIC_ACQUIRE)) {
+        _mule_epoch_close(mule);
+    }
+
+    mu_debugf(mu_log_cat_sync, "mule_sync: queue-complete\n");
 
     return 0;
 }
@@ -316,7 +1705,9 @@ static int mule_reset(mu_mule *mule)
     atomic_store(&mule->processing, 0);
     atomic_store(&mule->processed, 0);
 
-    cnd_broadcast(&mule->wake_worker);
+    mule_scratch_reset(mule);
+
+    cnd_broadcast(&_mule_host(mule)->wake_worker);
 
     return 0;
 }
@@ -330,32 +1721,931 @@ static int mule_stop(mu_mule *mule)
     }
 
     /* shutdown workers */
-    debugf("mule_stop: stopping-threads\n");
+    mu_debugf(mu_log_cat_sync, "mule_stop: stopping-threads\n");
 
     atomic_store_explicit(&mule->running, 0, __ATOMIC_RELEASE);
+    atomic_store(&mule->stopping, 1);
     mtx_unlock(&mule->mutex);
     cnd_broadcast(&mule->wake_worker);
 
     /* join workers */
     for (size_t i = 0; i < mule->num_threads; i++) {
+        mu_thread *thread = &mule->threads[i];
         int res;
-        assert(!thrd_join(mule->threads[i].thread, &res));
+        if (thread->stack) {
+            assert(!pthread_join(thread->pthread, NULL));
+            munmap(thread->stack, thread->stack_map_size);
+            thread->stack = NULL;
+        } else {
+            assert(!thrd_join(thread->thread, &res));
+        }
+        mtx_lock(&mule->mutex);
+        _mule_perf_close(thread);
+        mtx_unlock(&mule->mutex);
     }
 
+    mtx_lock(&mule->mutex);
+    atomic_store(&mule->stopping, 0);
+    mtx_unlock(&mule->mutex);
+
     return 0;
 }
 
 static int mule_destroy(mu_mule *mule)
 {
+    mule_watchdog_stop(mule);
+    mule_record_config(mule, 0);
+    mule_unpublish(mule);
+    /* drop the shared pool reference so its workers stop at the last one */
+    if (mule->host == &mule_shared.mule) mule_shared_detach(mule);
+    else mule_detach(mule);
     mule_stop(mule);
 
     mtx_destroy(&mule->mutex);
     cnd_destroy(&mule->wake_worker);
     cnd_destroy(&mule->wake_dispatcher);
+    for (size_t i = 0; i < mule->num_threads; i++) {
+        _mule_scratch_free(&mule->threads[i].scratch);
+        free(mule->threads[i].hist);
+    }
+    if (mule->epoch) {
+        free(mule->epoch->base);
+        free(mule->epoch->perf_base);
+        free(mule->epoch->workers);
+        free(mule->epoch->stats);
+        free(mule->epoch->perf);
+        mtx_destroy(&mule->epoch->lock);
+        free(mule->epoch);
+        mule->epoch = NULL;
+    }
+    mule_trace_config(mule, 0, 0);
+    free(mule->threads);
+    mule->threads = NULL;
+
+    return 0;
+}
+
+static int mule_attach(mu_mule *arena, mu_mule *host, size_t max_concurrency)
+{
+    assert(arena->num_threads == 0 && !arena->host && !host->host);
+
+    arena->max_concurrency = max_concurrency;
+
+    mtx_lock(&host->mutex);
+    for (size_t slot = 0; slot < mumule_max_arenas; slot++) {
+        if (atomic_load(&host->arenas[slot])) continue;
+        arena->host = host;
+        atomic_store_explicit(&host->arenas[slot], arena, __ATOMIC_SEQ_CST);
+        mtx_unlock(&host->mutex);
+        mu_debugf(mu_log_cat_sync, "mule_attach: arena-attached (slot=%zu)\n", slot);
+        cnd_broadcast(&host->wake_worker);
+        return 0;
+    }
+    mtx_unlock(&host->mutex);
+
+    return -1;
+}
+
+static int mule_detach(mu_mule *arena)
+{
+    mu_mule *host = arena->host;
+
+    if (!host) return 0;
+
+    mule_sync(arena);
+
+    mtx_lock(&host->mutex);
+    for (size_t slot = 0; slot < mumule_max_arenas; slot++) {
+        if (atomic_load(&host->arenas[slot]) == arena) {
+            atomic_store_explicit(&host->arenas[slot], NULL, __ATOMIC_SEQ_CST);
+        }
+    }
+    mtx_unlock(&host->mutex);
+
+    /*
+     * wait for workers that may still hold the arena to finish scanning.
+     * the slot store must be ordered before the epoch loads, pairing with
+     * the epoch bump before the worker's slot loads in _mule_run_arenas.
+     */
+    atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (size_t i = 0; i < host->num_threads; i++) {
+        size_t epoch = atomic_load(&host->threads[i].epoch);
+        if (epoch & 1) {
+            while (atomic_load(&host->threads[i].epoch) == epoch) thrd_yield();
+        }
+    }
+    arena->host = NULL;
+
+    mu_debugf(mu_log_cat_sync, "mule_detach: arena-detached\n");
+
+    return 0;
+}
+
+/* online processors, clamped to 1 and mumule_max_threads */
+static size_t mule_hardware_threads()
+{
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu < 1) ncpu = 1;
+    if (ncpu > mumule_max_threads) ncpu = mumule_max_threads;
+    return (size_t)ncpu;
+}
+
+static void _mule_shared_init()
+{
+    mtx_init(&mule_shared.lock, mtx_plain);
+    mule_init(&mule_shared.mule, mule_hardware_threads(), NULL, NULL);
+    mule_shared.mule.lazy_start = 1;
+}
+
+static int mule_shared_attach(mu_mule *arena, size_t max_concurrency)
+{
+    int ret;
+
+    call_once(&mule_shared.once, _mule_shared_init);
+
+    mtx_lock(&mule_shared.lock);
+    ret = mule_attach(arena, &mule_shared.mule, max_concurrency);
+    if (!ret) mule_shared.refcount++;
+    mtx_unlock(&mule_shared.lock);
+
+    return ret;
+}
+
+static int mule_shared_detach(mu_mule *arena)
+{
+    if (arena->host != &mule_shared.mule) return -1;
+
+    mule_detach(arena);
+
+    /* stop the shared workers when the last component detaches */
+    mtx_lock(&mule_shared.lock);
+    if (--mule_shared.refcount == 0) {
+        mu_debugf(mu_log_cat_sync, "mule_shared_detach: last-reference\n");
+        mule_stop(&mule_shared.mule);
+    }
+    mtx_unlock(&mule_shared.lock);
 
     return 0;
 }
 
+/*
+ * set worker thread attributes. takes effect at the next mule_start.
+ */
+static void mule_thread_attr(mu_mule *mule, const mu_thread_attr *attr)
+{
+    mule->thread_attr = *attr;
+}
+
+/*
+ * configure optional statistics before mule_start. histograms are
+ * allocated per worker when `mumule_stats_histogram` is first set.
+ */
+static void mule_stats_config(mu_mule *mule, int flags)
+{
+    mule->stats_flags = flags;
+    _mule_ns_per_tick();
+    if ((flags & mumule_stats_epoch) && !mule->epoch) {
+        size_t n = _mule_host(mule)->num_threads;
+        mu_epoch *epoch;
+        assert((epoch = (mu_epoch*)calloc(1, sizeof(mu_epoch))));
+        mtx_init(&epoch->lock, mtx_plain);
+        assert((epoch->base = (mu_worker_stats*)calloc(n + 1, sizeof(mu_worker_stats))));
+        assert((epoch->perf_base = (mu_perf_counters*)calloc(n + 1, sizeof(mu_perf_counters))));
+        assert((epoch->workers = (mu_worker_epoch*)calloc(n + 1, sizeof(mu_worker_epoch))));
+        assert((epoch->stats = (mu_worker_stats*)calloc(n + 1, sizeof(mu_worker_stats))));
+        assert((epoch->perf = (mu_perf_counters*)calloc(n + 1, sizeof(mu_perf_counters))));
+        mule->epoch = epoch;
+    }
+    if (!(flags & mumule_stats_histogram)) return;
+    for (size_t i = 0; i < mule->num_threads; i++) {
+        if (mule->threads[i].hist) continue;
+        assert((mule->threads[i].hist = (mu_thread_hist*)aligned_alloc(64,
+            (sizeof(mu_thread_hist) + 63) & ~(size_t)63)));
+        memset(mule->threads[i].hist, 0, sizeof(mu_thread_hist));
+    }
+}
+
+/*
+ * snapshot statistics. `workers` may be NULL or point to num_threads
+ * entries of the host, which runs the items of arenas attached to it.
+ */
+static void mule_stats(mu_mule *mule, mu_stats *stats, mu_worker_stats *workers)
+{
+    mu_mule *host = _mule_host(mule);
+
+    memset(stats, 0, sizeof(mu_stats));
+    stats->num_threads = host->num_threads;
+    stats->syncs = atomic_load_explicit(&mule->syncs, __ATOMIC_RELAXED);
+    stats->sync_waits = atomic_load_explicit(&mule->sync_waits, __ATOMIC_RELAXED);
+    stats->sync_timeouts = atomic_load_explicit(&mule->sync_timeouts, __ATOMIC_RELAXED);
+
+    for (size_t i = 0; i < host->num_threads; i++) {
+        mu_counters *c = &host->threads[i].counters;
+        mu_worker_stats w = {
+            atomic_load_explicit(&c->items, __ATOMIC_RELAXED),
+            (uint64_t)(atomic_load_explicit(&c->busy_ticks, __ATOMIC_RELAXED)
+                * _mule_ns_per_tick()),
+            atomic_load_explicit(&c->park_ns, __ATOMIC_RELAXED),
+            atomic_load_explicit(&c->parks, __ATOMIC_RELAXED),
+            atomic_load_explicit(&c->wake_signals, __ATOMIC_RELAXED),
+            atomic_load_explicit(&c->wake_timeouts, __ATOMIC_RELAXED),
+            atomic_load_explicit(&c->cas_failures, __ATOMIC_RELAXED),
+        };
+        if (workers) workers[i] = w;
+        stats->total.items += w.items;
+        stats->total.busy_ns += w.busy_ns;
+        stats->total.park_ns += w.park_ns;
+        stats->total.parks += w.parks;
+        stats->total.wake_signals += w.wake_signals;
+        stats->total.wake_timeouts += w.wake_timeouts;
+        stats->total.cas_failures += w.cas_failures;
+    }
+}
+
+/*
+ * read the hardware counters of the workers of the host into `total`
+ * and, when `workers` is not NULL, num_threads per-worker entries.
+ * either may be NULL. returns -1 if no counter could be opened. takes the
+ * host mutex, so it must not be called with it held.
+ */
+static int mule_perf(mu_mule *mule, mu_perf_counters *total, mu_perf_counters *workers)
+{
+    mu_mule *host = _mule_host(mule);
+    uint64_t sum[mumule_perf_count] = { 0 }, value[mumule_perf_count];
+    int open = 0;
+
+    mtx_lock(&host->mutex);
+    for (size_t i = 0; i < host->num_threads; i++) {
+        open += _mule_perf_read(&host->threads[i], value);
+        for (size_t k = 0; k < mumule_perf_count; k++) sum[k] += value[k];
+        if (workers) _mule_perf_counters(&workers[i], value);
+    }
+    mtx_unlock(&host->mutex);
+    if (total) _mule_perf_counters(total, sum);
+
+    return open || sum[mumule_perf_cycles] || sum[mumule_perf_instructions] ? 0 : -1;
+}
+
+/*
+ * copy the report of the last closed sync epoch and, when `workers` is
+ * not NULL, num_threads per-worker entries. returns -1 if epochs are not
+ * enabled or none has closed yet.
+ */
+static int mule_epoch_report(mu_mule *mule, mu_epoch_report *report, mu_worker_epoch *workers)
+{
+    mu_epoch *epoch = mule->epoch;
+
+    if (!epoch) return -1;
+    mtx_lock(&epoch->lock);
+    *report = epoch->report;
+    if (workers) memcpy(workers, epoch->workers, report->num_threads * sizeof(mu_worker_epoch));
+    mtx_unlock(&epoch->lock);
+
+    return report->epoch ? 0 : -1;
+}
+
+/*
+ * merge the `mumule_hist_kernel` or `mumule_hist_delay` histograms of
+ * all workers of the host. buckets are in ticks, use
+ * `mule_histogram_percentile` to read nanoseconds.
+ */
+static void mule_histogram(mu_mule *mule, int which, mu_histogram *hist)
+{
+    mu_mule *host = _mule_host(mule);
+
+    memset(hist, 0, sizeof(mu_histogram));
+    hist->ns_per_tick = _mule_ns_per_tick();
+
+    uint64_t min = UINT64_MAX, max = 0, sum = 0;
+    for (size_t i = 0; i < host->num_threads; i++) {
+        mu_thread_hist *th = host->threads[i].hist;
+        if (!th) continue;
+        mu_hist *h = which == mumule_hist_delay ? &th->delay : &th->kernel;
+        uint64_t count = atomic_load_explicit(&h->count, __ATOMIC_ACQUIRE);
+        if (!count) continue;
+        hist->count += count;
+        sum += atomic_load_explicit(&h->sum, __ATOMIC_RELAXED);
+        uint64_t hmin = atomic_load_explicit(&h->min, __ATOMIC_RELAXED);
+        uint64_t hmax = atomic_load_explicit(&h->max, __ATOMIC_RELAXED);
+        if (hmin < min) min = hmin;
+        if (hmax > max) max = hmax;
+        for (size_t j = 0; j < mumule_hist_buckets; j++) {
+            hist->buckets[j] += atomic_load_explicit(&h->buckets[j], __ATOMIC_RELAXED);
+        }
+    }
+    if (hist->count) {
+        hist->sum_ns = (uint64_t)(sum * hist->ns_per_tick);
+        hist->min_ns = (uint64_t)(min * hist->ns_per_tick);
+        hist->max_ns = (uint64_t)(max * hist->ns_per_tick);
+    }
+}
+
+/*
+ * value in nanoseconds at percentile `p` (0..100) of a merged histogram.
+ * the result is the upper bound of the bucket, clamped to the maximum.
+ * buckets are summed independently of count while workers run, so the
+ * walk uses the bucket total.
+ */
+static uint64_t mule_histogram_percentile(const mu_histogram *hist, double p)
+{
+    uint64_t total = 0, seen = 0;
+    for (size_t j = 0; j < mumule_hist_buckets; j++) total += hist->buckets[j];
+    if (!total) return 0;
+
+    uint64_t rank = (uint64_t)(p / 100.0 * total + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > total) rank = total;
+    for (size_t j = 0; j < mumule_hist_buckets; j++) {
+        seen += hist->buckets[j];
+        if (seen >= rank) {
+            uint64_t ns = (uint64_t)(_mule_hist_bucket_value(j) * hist->ns_per_tick);
+            return ns < hist->max_ns ? ns : hist->max_ns;
+        }
+    }
+    return hist->max_ns;
+}
+
+/*
+ * copy up to `n` of the slowest items across all workers, slowest first.
+ * returns the number of items copied.
+ */
+static size_t mule_slowest(mu_mule *mule, mu_slow_item *items, size_t n)
+{
+    mu_mule *host = _mule_host(mule);
+    double ns_per_tick = _mule_ns_per_tick();
+    size_t count = 0;
+
+    for (size_t i = 0; i < host->num_threads; i++) {
+        mu_thread_hist *th = host->threads[i].hist;
+        if (!th) continue;
+
+        uint64_t ticks[mumule_slowest_items], item_idx[mumule_slowest_items];
+        uint32_t seq0, seq1;
+        do {
+            seq0 = atomic_load_explicit(&th->slowest.seq, __ATOMIC_ACQUIRE);
+            for (size_t k = 0; k < mumule_slowest_items; k++) {
+                ticks[k] = atomic_load_explicit(&th->slowest.ticks[k], __ATOMIC_RELAXED);
+                item_idx[k] = atomic_load_explicit(&th->slowest.item_idx[k], __ATOMIC_RELAXED);
+            }
+            atomic_thread_fence(__ATOMIC_ACQUIRE);
+            seq1 = atomic_load_explicit(&th->slowest.seq, __ATOMIC_RELAXED);
+        } while ((seq0 & 1) || seq0 != seq1);
+
+        /* insertion into the sorted output, dropping the fastest */
+        for (size_t k = 0; k < mumule_slowest_items; k++) {
+            if (!ticks[k]) continue;
+            mu_slow_item item = { (uint64_t)(ticks[k] * ns_per_tick), item_idx[k], i };
+            size_t j = count < n ? count++ : n;
+            while (j > 0 && items[j - 1].ns < item.ns) {
+                if (j < n) items[j] = items[j - 1];
+                j--;
+            }
+            if (j < n) items[j] = item;
+        }
+    }
+
+    return count;
+}
+
+static mu_trace_ring* _mule_trace_ring_new(size_t events, size_t sample_rate)
+{
+    mu_trace_ring *ring = (mu_trace_ring*)calloc(1,
+        sizeof(mu_trace_ring) + events * sizeof(mu_trace_event));
+    if (!ring) return NULL;
+    ring->mask = events - 1;
+    ring->sample_rate = sample_rate;
+    ring->countdown = 1;
+    return ring;
+}
+
+/*
+ * configure timeline tracing while threads are stopped. each worker and
+ * the host keep a ring of `events` (rounded up to a power of two), and
+ * workers record one in `sample_rate` items. zero events disables tracing
+ * and frees the rings. returns -1 if the rings cannot be allocated.
+ */
+static int mule_trace_config(mu_mule *mule, size_t events, size_t sample_rate)
+{
+    for (size_t i = 0; i < mule->num_threads; i++) {
+        free(mule->threads[i].trace);
+        mule->threads[i].trace = NULL;
+    }
+    free(mule->trace);
+    mule->trace = NULL;
+    if (!events) return 0;
+
+    size_t n = 1;
+    while (n < events) n <<= 1;
+    if (!sample_rate) sample_rate = 1;
+
+    _mule_ns_per_tick();
+    mule->trace_base = _mule_ticks();
+    if (!(mule->trace = _mule_trace_ring_new(n, 1))) return -1;
+    for (size_t i = 0; i < mule->num_threads; i++) {
+        if (!(mule->threads[i].trace = _mule_trace_ring_new(n, sample_rate))) {
+            mule_trace_config(mule, 0, 0);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void _mule_trace_write_ring(FILE *f, mu_mule *host, mu_trace_ring *ring,
+    size_t tid, const char **sep)
+{
+    static const char *names[] = { "item", "claim", "claim-lost", "park", "submit", "sync" };
+    double us_per_tick = _mule_ns_per_tick() / 1000.0;
+    size_t head = atomic_load_explicit(&ring->head, __ATOMIC_ACQUIRE);
+    size_t first = head > ring->mask + 1 ? head - ring->mask - 1 : 0;
+
+    for (size_t i = first; i < head; i++) {
+        mu_trace_event *e = &ring->events[i & ring->mask];
+        if (e->ticks < host->trace_base || e->type > mumule_trace_sync) continue;
+        double ts = (e->ticks - host->trace_base) * us_per_tick;
+        const char *name = names[e->type];
+        switch (e->type) {
+        case mumule_trace_claim_lost:
+        case mumule_trace_submit:
+            fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,"
+                "\"tid\":%zu,\"ts\":%.3f,\"args\":{\"%s\":%llu}}", *sep, name,
+                (int)getpid(), tid, ts, e->type == mumule_trace_submit ? "count" : "item",
+                (unsigned long long)e->arg);
+            break;
+        case mumule_trace_park:
+            fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%zu,"
+                "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"wake\":\"%s\"}}", *sep, name,
+                (int)getpid(), tid, ts, e->dur * us_per_tick, e->arg ? "timeout" : "signal");
+            break;
+        default:
+            fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%zu,"
+                "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"%s\":%llu}}", *sep, name,
+                (int)getpid(), tid, ts, e->dur * us_per_tick,
+                e->type == mumule_trace_sync ? "queued" : "item", (unsigned long long)e->arg);
+            break;
+        }
+        *sep = ",";
+    }
+}
+
+/*
+ * write the recorded timelines of the host as a Chrome trace event JSON
+ * file. workers appear as threads `mule-<idx>` and submits and syncs on
+ * a `dispatch` thread. returns -1 if tracing is off or on i/o error.
+ */
+static int mule_trace_write(mu_mule *mule, const char *path)
+{
+    mu_mule *host = _mule_host(mule);
+    const char *sep = "";
+    FILE *f;
+
+    if (!host->trace || !(f = fopen(path, "w"))) return -1;
+
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (size_t i = 0; i <= host->num_threads; i++) {
+        fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%zu,"
+            "\"args\":{\"name\":\"", sep, (int)getpid(), i);
+        if (i < host->num_threads) fprintf(f, "mule-%zu\"}}", i);
+        else fprintf(f, "dispatch\"}}");
+        sep = ",";
+    }
+    for (size_t i = 0; i < host->num_threads; i++) {
+        _mule_trace_write_ring(f, host, host->threads[i].trace, i, &sep);
+    }
+    _mule_trace_write_ring(f, host, host->trace, host->num_threads, &sep);
+    fprintf(f, "\n]}\n");
+
+    return fclose(f) ? -1 : 0;
+}
+
+static void _mule_publish_update(mu_publisher *pub)
+{
+    mu_mule *mule = pub->mule, *host = _mule_host(mule);
+    mu_shm_page *page = pub->page;
+    mu_worker_stats *workers = pub->workers;
+    mu_stats stats;
+
+    mule_stats(mule, &stats, workers);
+
+    uint64_t seq = atomic_load_explicit(&page->seq, __ATOMIC_RELAXED);
+    atomic_store_explicit(&page->seq, seq + 1, __ATOMIC_RELAXED);
+    atomic_thread_fence(__ATOMIC_RELEASE);
+    page->time_ns = _mule_now_ns();
+    page->updates++;
+    page->queued = atomic_load_explicit(&mule->queued, __ATOMIC_RELAXED);
+    page->processing = atomic_load_explicit(&mule->processing, __ATOMIC_RELAXED);
+    page->processed = atomic_load_explicit(&mule->processed, __ATOMIC_RELAXED);
+    page->syncs = stats.syncs;
+    page->sync_waits = stats.sync_waits;
+    page->sync_timeouts = stats.sync_timeouts;
+    for (size_t i = 0; i < stats.num_threads; i++) {
+        mu_shm_worker *w = &page->workers[i];
+        w->items = workers[i].items;
+        w->busy_ns = workers[i].busy_ns;
+        w->park_ns = workers[i].park_ns;
+        w->parks = workers[i].parks;
+        w->wake_timeouts = workers[i].wake_timeouts;
+        w->cas_failures = workers[i].cas_failures;
+        w->parked = atomic_load_explicit(&host->threads[i].parked, __ATOMIC_RELAXED);
+    }
+    atomic_store_explicit(&page->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static int _mule_publisher(void *arg)
+{
+    mu_publisher *pub = (mu_publisher*)arg;
+
+    mtx_lock(&pub->lock);
+    while (pub->running) {
+        _mule_publish_update(pub);
+        struct timespec abstime = { 0 };
+        assert(!clock_gettime(CLOCK_REALTIME, &abstime));
+        abstime = _timespec_add(abstime, (llong)pub->interval_ns);
+        cnd_timedwait(&pub->wake, &pub->lock, &abstime);
+    }
+    _mule_publish_update(pub);
+    mtx_unlock(&pub->lock);
+
+    return 0;
+}
+
+/* metrics page path for a name, shared with mulestat */
+static void mule_publish_path(char *buf, size_t size, const char *name)
+{
+    if (strchr(name, '/')) snprintf(buf, size, "%s", name);
+    else snprintf(buf, size, "/dev/shm/mule-%s", name);
+}
+
+/*
+ * publish live metrics of the mule to a shared memory page, updated every
+ * `interval_ns` (0 for 100 ms) by a publisher thread. arenas publish their
+ * own queue with the workers of their host. returns -1 on error.
+ */
+static int mule_publish(mu_mule *mule, const char *name, uint64_t interval_ns)
+{
+    mu_mule *host = _mule_host(mule);
+    mu_publisher *pub;
+    int fd;
+
+    if (mule->publisher) return -1;
+    if (!(pub = (mu_publisher*)calloc(1, sizeof(mu_publisher)))) return -1;
+    mule_publish_path(pub->path, sizeof(pub->path), name);
+    pub->mule = mule;
+    pub->interval_ns = interval_ns ? interval_ns : mumule_publish_interval_ns;
+    pub->map_size = sizeof(mu_shm_page) + host->num_threads * sizeof(mu_shm_worker);
+    pub->workers = (mu_worker_stats*)calloc(host->num_threads + 1, sizeof(mu_worker_stats));
+    if (!pub->workers) goto err;
+
+    if ((fd = open(pub->path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) goto err;
+    if (ftruncate(fd, (off_t)pub->map_size) < 0) goto err_close;
+    pub->page = (mu_shm_page*)mmap(NULL, pub->map_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED, fd, 0);
+    if (pub->page == MAP_FAILED) goto err_close;
+    close(fd);
+
+    pub->page->version = mumule_shm_version;
+    pub->page->num_threads = (uint32_t)host->num_threads;
+    pub->page->pid = (uint64_t)getpid();
+    pub->page->interval_ns = pub->interval_ns;
+    atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(pub->page->magic, mumule_shm_magic, sizeof(mumule_shm_magic));
+
+    mtx_init(&pub->lock, mtx_plain);
+    cnd_init(&pub->wake);
+    pub->running = 1;
+    if (thrd_create(&pub->thread, _mule_publisher, pub) != thrd_success) {
+        mtx_destroy(&pub->lock);
+        cnd_destroy(&pub->wake);
+        munmap(pub->page, pub->map_size);
+        goto err_unlink;
+    }
+    mule->publisher = pub;
+
+    return 0;
+
+err_close:
+    close(fd);
+err_unlink:
+    unlink(pub->path);
+err:
+    free(pub->workers);
+    free(pub);
+    return -1;
+}
+
+/* stop the publisher, write a final update and remove the page */
+static int mule_unpublish(mu_mule *mule)
+{
+    mu_publisher *pub = mule->publisher;
+
+    if (!pub) return -1;
+    mtx_lock(&pub->lock);
+    pub->running = 0;
+    cnd_signal(&pub->wake);
+    mtx_unlock(&pub->lock);
+    thrd_join(pub->thread, NULL);
+
+    mtx_destroy(&pub->lock);
+    cnd_destroy(&pub->wake);
+    munmap(pub->page, pub->map_size);
+    unlink(pub->path);
+    free(pub->workers);
+    free(pub);
+    mule->publisher = NULL;
+
+    return 0;
+}
+
+static int _mule_u64_cmp(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static void _mule_watchdog_log(void *arg, const mu_straggler *s)
+{
+    log_printf("mule_watchdog: thread %zu item %zu running for %llu us (median %llu us)\n",
+        s->thr_idx, s->item_idx, (unsigned long long)(s->elapsed_ns / 1000),
+        (unsigned long long)(s->median_ns / 1000));
+}
+
+/* median of the recent durations of all workers, 0 if too few samples */
+static uint64_t _mule_watchdog_median(mu_watchdog *wd)
+{
+    mu_mule *mule = wd->mule;
+    size_t n = 0;
+
+    for (size_t i = 0; i < mule->num_threads; i++) {
+        for (size_t k = 0; k < mumule_watchdog_recent; k++) {
+            uint64_t v = atomic_load_explicit(&mule->threads[i].recent_ns[k], __ATOMIC_RELAXED);
+            if (v) wd->samples[n++] = v - 1;
+        }
+    }
+    if (n < mumule_watchdog_min_samples) return 0;
+    qsort(wd->samples, n, sizeof(uint64_t), _mule_u64_cmp);
+    return wd->samples[n / 2];
+}
+
+static void _mule_watchdog_check(mu_watchdog *wd)
+{
+    mu_mule *mule = wd->mule;
+    uint64_t median = wd->median_factor > 0 ? _mule_watchdog_median(wd) : 0;
+    uint64_t limit = wd->threshold_ns;
+    uint64_t now = _mule_now_ns();
+
+    if (median && (!limit || median * wd->median_factor < limit)) {
+        limit = (uint64_t)(median * wd->median_factor);
+    }
+    if (!limit) return;
+
+    for (size_t i = 0; i < mule->num_threads; i++) {
+        mu_thread *thread = &mule->threads[i];
+        uint64_t start = atomic_load_explicit(&thread->item_start_ns, __ATOMIC_ACQUIRE);
+        if (!start || start == wd->reported[i] || now < start || now - start < limit) continue;
+        mu_straggler s = {
+            atomic_load_explicit(&thread->item_queue, __ATOMIC_RELAXED), i,
+            atomic_load_explicit(&thread->item_idx, __ATOMIC_RELAXED), now - start, median
+        };
+        atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (atomic_load_explicit(&thread->item_start_ns, __ATOMIC_RELAXED) != start) continue;
+        wd->reported[i] = start;
+        wd->fn(wd->arg, &s);
+    }
+}
+
+static int _mule_watchdog_thread(void *arg)
+{
+    mu_watchdog *wd = (mu_watchdog*)arg;
+
+    mtx_lock(&wd->lock);
+    while (wd->running) {
+        struct timespec abstime = { 0 };
+        assert(!clock_gettime(CLOCK_REALTIME, &abstime));
+        abstime = _timespec_add(abstime, (llong)wd->interval_ns);
+        cnd_timedwait(&wd->wake, &wd->lock, &abstime);
+        if (wd->running) _mule_watchdog_check(wd);
+    }
+    mtx_unlock(&wd->lock);
+
+    return 0;
+}
+
+/*
+ * start a watchdog on a mule with threads. items running longer than
+ * `threshold_ns`, or `median_factor` times the median recent duration,
+ * are reported once to `fn`, or logged when `fn` is NULL. the lower
+ * limit applies when both are set. returns -1 on error.
+ */
+static int mule_watchdog(mu_mule *mule, uint64_t threshold_ns, double median_factor,
+    mumule_straggler_fn fn, void *arg)
+{
+    mu_watchdog *wd;
+
+    if (mule->watchdog || !mule->num_threads) return -1;
+    if (!threshold_ns && median_factor <= 0) return -1;
+    if (!(wd = (mu_watchdog*)calloc(1, sizeof(mu_watchdog)))) return -1;
+    wd->reported = (uint64_t*)calloc(mule->num_threads, sizeof(uint64_t));
+    wd->samples = (uint64_t*)calloc(mule->num_threads * mumule_watchdog_recent,
+        sizeof(uint64_t));
+    if (!wd->reported || !wd->samples) goto err;
+
+    wd->mule = mule;
+    wd->threshold_ns = threshold_ns;
+    wd->median_factor = median_factor;
+    wd->interval_ns = threshold_ns ? threshold_ns / 4 : mumule_watchdog_interval_ns;
+    if (wd->interval_ns < 1000000) wd->interval_ns = 1000000;
+    if (wd->interval_ns > mumule_watchdog_interval_ns * 10) {
+        wd->interval_ns = mumule_watchdog_interval_ns * 10;
+    }
+    wd->fn = fn ? fn : _mule_watchdog_log;
+    wd->arg = arg;
+    wd->running = 1;
+
+    mtx_init(&wd->lock, mtx_plain);
+    cnd_init(&wd->wake);
+    atomic_store_explicit(&mule->watchdog_on, 1, __ATOMIC_RELAXED);
+    if (thrd_create(&wd->thread, _mule_watchdog_thread, wd) != thrd_success) {
+        atomic_store_explicit(&mule->watchdog_on, 0, __ATOMIC_RELAXED);
+        mtx_destroy(&wd->lock);
+        cnd_destroy(&wd->wake);
+        goto err;
+    }
+    mule->watchdog = wd;
+
+    return 0;
+
+err:
+    free(wd->reported);
+    free(wd->samples);
+    free(wd);
+    return -1;
+}
+
+static int mule_watchdog_stop(mu_mule *mule)
+{
+    mu_watchdog *wd = mule->watchdog;
+
+    if (!wd) return -1;
+    mtx_lock(&wd->lock);
+    wd->running = 0;
+    cnd_signal(&wd->wake);
+    mtx_unlock(&wd->lock);
+    thrd_join(wd->thread, NULL);
+
+    atomic_store_explicit(&mule->watchdog_on, 0, __ATOMIC_RELAXED);
+    mtx_destroy(&wd->lock);
+    cnd_destroy(&wd->wake);
+    free(wd->reported);
+    free(wd->samples);
+    free(wd);
+    mule->watchdog = NULL;
+
+    return 0;
+}
+
+/*
+ * record the next `max_items` items submitted to the mule, zero stops
+ * recording and frees the recording. returns -1 on allocation failure.
+ */
+static int mule_record_config(mu_mule *mule, size_t max_items)
+{
+    mu_recorder *rec = mule->record;
+
+    if (rec) {
+        mule->record = NULL;
+        mtx_destroy(&rec->lock);
+        free(rec->ticks);
+        free(rec->events);
+        free(rec);
+    }
+    if (!max_items) return 0;
+
+    if (!(rec = (mu_recorder*)calloc(1, sizeof(mu_recorder)))) return -1;
+    if (!(rec->ticks = (uint64_t*)calloc(max_items, sizeof(uint64_t)))) {
+        free(rec);
+        return -1;
+    }
+    _mule_ns_per_tick();
+    mtx_init(&rec->lock, mtx_plain);
+    rec->base = atomic_load_explicit(&mule->queued, __ATOMIC_ACQUIRE);
+    rec->max_items = max_items;
+    mule->record = rec;
+
+    return 0;
+}
+
+static int mule_record_write(mu_mule *mule, const char *path)
+{
+    mu_recorder *rec = mule->record;
+    double ns_per_tick = _mule_ns_per_tick();
+    size_t items = 0;
+    FILE *f;
+
+    if (!rec || !(f = fopen(path, "w"))) return -1;
+
+    mtx_lock(&rec->lock);
+    uint64_t t0 = rec->num_events ? rec->events[0].time_ns : 0;
+    fprintf(f, "mumule-record 1\nthreads %zu\n", _mule_host(mule)->num_threads);
+    for (size_t i = 0; i < rec->num_events; i++) {
+        mu_record_event *e = &rec->events[i];
+        if (e->type == mumule_record_submit) {
+            fprintf(f, "submit %llu %llu\n", (unsigned long long)(e->time_ns - t0),
+                (unsigned long long)e->count);
+            items += e->count;
+        } else {
+            fprintf(f, "sync %llu\n", (unsigned long long)(e->time_ns - t0));
+        }
+    }
+    mtx_unlock(&rec->lock);
+
+    if (items > rec->max_items) items = rec->max_items;
+    fprintf(f, "items %zu\n", items);
+    for (size_t i = 0; i < items; i++) {
+        uint64_t ticks = rec->ticks[i];
+        fprintf(f, "%llu\n", ticks ? (unsigned long long)((ticks - 1) * ns_per_tick) : 0ull);
+    }
+
+    return fclose(f) ? -1 : 0;
+}
+
+static void mule_scratch_config(mu_mule *mule, size_t block_size, int flags)
+{
+    mule->scratch_block_size = block_size;
+    mule->scratch_flags = flags;
+}
+
+static mu_scratch_block* _mule_scratch_block_new(mu_mule *mule, size_t size, size_t align)
+{
+    size_t block_size = mule->scratch_block_size ? mule->scratch_block_size
+        : mumule_scratch_block_size;
+    size_t map_align = mule->scratch_flags & mumule_scratch_hugepages
+        ? mumule_scratch_huge_page_size : (size_t)sysconf(_SC_PAGESIZE);
+    size_t map_size = sizeof(mu_scratch_block) + align + size;
+    mu_scratch_block *b;
+    void *p;
+
+    if (map_size < block_size) map_size = block_size;
+    map_size = (map_size + map_align - 1) & ~(map_align - 1);
+
+    p = _mule_map_aligned(map_size, map_align, 0, MAP_PRIVATE | MAP_ANONYMOUS);
+    if (p == MAP_FAILED) return NULL;
+#if defined(MADV_HUGEPAGE)
+    if (mule->scratch_flags & mumule_scratch_hugepages) {
+        madvise(p, map_size, MADV_HUGEPAGE);
+    }
+#endif
+
+    b = (mu_scratch_block*)p;
+    b->next = NULL;
+    b->size = map_size - sizeof(mu_scratch_block);
+    b->used = 0;
+    b->map_size = map_size;
+
+    return b;
+}
+
+/*
+ * allocate `size` bytes aligned to `align` (a power of two, zero for 16)
+ * from the scratch of worker `thr_idx`. only call from within a kernel
+ * using the `thr_idx` it was passed. returns NULL if out of memory.
+ */
+static void* mule_scratch_alloc(mu_mule *mule, size_t thr_idx, size_t size, size_t align)
+{
+    mu_mule *host = _mule_host(mule);
+    mu_scratch *scratch;
+    mu_scratch_block *b, *nb;
+
+    assert(thr_idx < host->num_threads);
+    scratch = &host->threads[thr_idx].scratch;
+    if (!align) align = 16;
+
+    for (b = scratch->cur; ; ) {
+        if (b) {
+            uintptr_t base = (uintptr_t)(b + 1);
+            size_t off = ((base + b->used + align - 1) & ~(uintptr_t)(align - 1)) - base;
+            if (off + size <= b->size) {
+                b->used = off + size;
+                return (void*)(base + off);
+            }
+            if (b->next) {
+                b = scratch->cur = b->next;
+                b->used = 0;
+                continue;
+            }
+        }
+        if (!(nb = _mule_scratch_block_new(host, size, align))) return NULL;
+        if (b) b->next = nb; else scratch->head = nb;
+        b = scratch->cur = nb;
+    }
+}
+
+static void mule_scratch_reset(mu_mule *mule)
+{
+    /* arenas share their host's scratch so only the host drives the epoch */
+    if (mule->host) return;
+    atomic_fetch_add_explicit(&mule->scratch_epoch, 1, __ATOMIC_RELAXED);
+}
+
 #ifdef __cplusplus
 }
 #endif
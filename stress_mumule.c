@@ -0,0 +1,266 @@
+/*
+ * stress_mumule - randomized in-process stress test
+ *
+ * usage: stress_mumule [-t threads] [-p producers] [-d seconds]
+ *                      [-b batch] [-l bound-ms] [-f fault-us] [-s seed]
+ *
+ * producer threads randomly interleave mule_submit, mule_sync, mule_reset,
+ * mule_stop and mule_start for the time budget. submits, syncs, stops and
+ * starts run concurrently; a stop is followed by a start from the same
+ * producer so concurrent syncs always drain. the pool starts lazily, so
+ * submits also race to restart it. resets take the pool exclusively and
+ * leave it stopped half the time. the kernel sets a bit per item index and
+ * every reset checks that each submitted item ran exactly once. syncs
+ * slower than the latency bound are reported. with `-f` the fault
+ * injection hooks sleep for up to `fault-us` at the claim, park and sync
+ * points to widen lost-wakeup windows.
+ *
+ * exits non-zero if an item was lost or ran twice, or a sync was too slow.
+ */
+
+#undef NDEBUG
+#define MULE_FAULT_INJECTION
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "mumule.h"
+
+int debug = 0;
+
+enum { op_submit, op_sync, op_reset, op_stop, op_start, op_count };
+
+static const char *op_names[op_count] = { "submit", "sync", "reset", "stop", "start" };
+
+typedef struct {
+	mu_mule mule;
+	pthread_rwlock_t lock;
+	_Atomic(uint64_t) *bitmap;
+	size_t capacity;
+	size_t max_batch;
+	_Atomic(size_t) reserved;
+	_Atomic(size_t) items;
+	_Atomic(size_t) duplicates;
+	_Atomic(size_t) out_of_range;
+	_Atomic(size_t) missing;
+	_Atomic(uint64_t) ops[op_count];
+	_Atomic(uint64_t) slow_syncs;
+	_Atomic(uint64_t) max_sync_ns;
+	uint64_t bound_ns;
+	uint64_t deadline_ns;
+} stress;
+
+typedef struct { stress *s; uint64_t seed; } producer_arg;
+
+static unsigned fault_us;
+static _Thread_local uint64_t rng_state;
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t rng()
+{
+	if (!rng_state) rng_state = now_ns() | 1;
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state;
+}
+
+static void fault(int point)
+{
+	/* claims are frequent, delay fewer of them */
+	if (rng() % (point == mumule_fault_claim ? 64 : 8)) return;
+	struct timespec ts = { 0, (long)(rng() % (fault_us + 1)) * 1000 };
+	nanosleep(&ts, NULL);
+}
+
+static void kernel(void *arg, size_t thr_idx, size_t item_idx)
+{
+	stress *s = (stress*)arg;
+	if (item_idx == 0 || item_idx > s->capacity) {
+		atomic_fetch_add(&s->out_of_range, 1);
+		return;
+	}
+	size_t bit = item_idx - 1;
+	uint64_t mask = 1ull << (bit & 63);
+	if (atomic_fetch_or(&s->bitmap[bit >> 6], mask) & mask) {
+		atomic_fetch_add(&s->duplicates, 1);
+	}
+	atomic_fetch_add_explicit(&s->items, 1, __ATOMIC_RELAXED);
+}
+
+/* check items [1, reserved] ran and clear the bitmap, pool held exclusively */
+static void check_coverage(stress *s)
+{
+	size_t n = atomic_load(&s->reserved), words = (s->capacity + 63) / 64;
+	for (size_t w = 0; w < words; w++) {
+		uint64_t bits = atomic_load_explicit(&s->bitmap[w], __ATOMIC_RELAXED), want;
+		if (w * 64 + 64 <= n) want = ~0ull;
+		else if (w * 64 >= n) want = 0;
+		else want = (1ull << (n - w * 64)) - 1;
+		if (bits != want) {
+			atomic_fetch_add(&s->missing, __builtin_popcountll(want & ~bits));
+		}
+		atomic_store_explicit(&s->bitmap[w], 0, __ATOMIC_RELAXED);
+	}
+	atomic_store(&s->reserved, 0);
+}
+
+static void do_reset(stress *s)
+{
+	pthread_rwlock_wrlock(&s->lock);
+	/* every stop is restarted and submits start the pool, so it drains */
+	mule_sync(&s->mule);
+	if (rng() & 1) mule_stop(&s->mule);
+	mule_reset(&s->mule);
+	check_coverage(s);
+	pthread_rwlock_unlock(&s->lock);
+	atomic_fetch_add(&s->ops[op_reset], 1);
+}
+
+static void do_submit(stress *s)
+{
+	size_t count = 1 + rng() % s->max_batch;
+	pthread_rwlock_rdlock(&s->lock);
+	if (atomic_fetch_add(&s->reserved, count) + count > s->capacity) {
+		atomic_fetch_sub(&s->reserved, count);
+		pthread_rwlock_unlock(&s->lock);
+		do_reset(s);
+		return;
+	}
+	mule_submit(&s->mule, count);
+	pthread_rwlock_unlock(&s->lock);
+	atomic_fetch_add(&s->ops[op_submit], 1);
+}
+
+static void do_sync(stress *s)
+{
+	pthread_rwlock_rdlock(&s->lock);
+	uint64_t t0 = now_ns();
+	mule_sync(&s->mule);
+	uint64_t dt = now_ns() - t0;
+	pthread_rwlock_unlock(&s->lock);
+
+	uint64_t max = atomic_load(&s->max_sync_ns);
+	while (dt > max && !atomic_compare_exchange_weak(&s->max_sync_ns, &max, dt));
+	if (dt > s->bound_ns) {
+		atomic_fetch_add(&s->slow_syncs, 1);
+		fprintf(stderr, "stress_mumule: sync took %.3f ms\n", dt / 1e6);
+	}
+	atomic_fetch_add(&s->ops[op_sync], 1);
+}
+
+static void do_control(stress *s, int op)
+{
+	pthread_rwlock_rdlock(&s->lock);
+	if (op == op_stop) mule_stop(&s->mule);
+	mule_start(&s->mule);
+	pthread_rwlock_unlock(&s->lock);
+	atomic_fetch_add(&s->ops[op], 1);
+}
+
+static int producer(void *arg)
+{
+	stress *s = ((producer_arg*)arg)->s;
+	rng_state = ((producer_arg*)arg)->seed;
+	while (now_ns() < s->deadline_ns) {
+		unsigned r = rng() % 100;
+		if (r < 55) do_submit(s);
+		else if (r < 85) do_sync(s);
+		else if (r < 92) do_reset(s);
+		else if (r < 96) do_control(s, op_stop);
+		else do_control(s, op_start);
+	}
+	return 0;
+}
+
+int main(int argc, const char **argv)
+{
+	size_t threads = 4, producers = 3;
+	double seconds = 2.0, bound_ms = 1000.0;
+	uint64_t seed = 0;
+	int usage = 0;
+	stress s;
+
+	memset(&s, 0, sizeof(s));
+	s.capacity = 1 << 20;
+	s.max_batch = 1000;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			threads = (size_t)atol(argv[++i]);
+		} else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+			producers = (size_t)atol(argv[++i]);
+		} else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+			seconds = atof(argv[++i]);
+		} else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+			s.max_batch = (size_t)atol(argv[++i]);
+		} else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+			bound_ms = atof(argv[++i]);
+		} else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+			fault_us = (unsigned)atol(argv[++i]);
+		} else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			seed = strtoull(argv[++i], NULL, 10);
+		} else {
+			usage = 1;
+		}
+	}
+	if (usage || threads == 0 || threads > mumule_max_threads || producers == 0 ||
+		producers > 64 || s.max_batch == 0 || s.max_batch > s.capacity) {
+		fprintf(stderr, "usage: %s [-t threads] [-p producers] [-d seconds] [-b batch] "
+			"[-l bound-ms] [-f fault-us] [-s seed]\n", argv[0]);
+		exit(1);
+	}
+	if (fault_us) mule_fault_hook = fault;
+	if (!seed) seed = now_ns();
+
+	assert((s.bitmap = calloc((s.capacity + 63) / 64, sizeof(uint64_t))));
+	pthread_rwlock_init(&s.lock, NULL);
+	s.bound_ns = (uint64_t)(bound_ms * 1e6);
+	mule_init(&s.mule, threads, kernel, &s);
+	s.mule.lazy_start = 1;
+	mule_start(&s.mule);
+
+	thrd_t thr[64];
+	producer_arg args[64];
+	uint64_t t0 = now_ns();
+	s.deadline_ns = t0 + (uint64_t)(seconds * 1e9);
+	for (size_t i = 0; i < producers; i++) {
+		/* distinct non-zero xorshift seeds per producer */
+		args[i].s = &s;
+		args[i].seed = (seed + i) * 0x9e3779b97f4a7c15ull | 1;
+		assert(!thrd_create(&thr[i], producer, &args[i]));
+	}
+	for (size_t i = 0; i < producers; i++) thrd_join(thr[i], NULL);
+
+	do_reset(&s);
+	uint64_t elapsed = now_ns() - t0;
+	mule_stop(&s.mule);
+	mule_destroy(&s.mule);
+
+	double sec = elapsed / 1e9;
+	printf("stress_mumule: seed %llu, %zu threads, %zu producers, %.2f s%s\n",
+		(unsigned long long)seed, threads, producers, sec, fault_us ? ", faults" : "");
+	for (int op = 0; op < op_count; op++) {
+		uint64_t n = atomic_load(&s.ops[op]);
+		printf("  %-8s %10llu %12.0f ops/s\n", op_names[op], (unsigned long long)n, n / sec);
+	}
+	printf("  %-8s %10zu %12.0f items/s\n", "items", atomic_load(&s.items),
+		atomic_load(&s.items) / sec);
+	printf("  max sync %.3f ms, %llu over %.1f ms\n", atomic_load(&s.max_sync_ns) / 1e6,
+		(unsigned long long)atomic_load(&s.slow_syncs), bound_ms);
+	printf("  missing %zu, duplicate %zu, out of range %zu\n", atomic_load(&s.missing),
+		atomic_load(&s.duplicates), atomic_load(&s.out_of_range));
+
+	pthread_rwlock_destroy(&s.lock);
+	free(s.bitmap);
+
+	int failed = atomic_load(&s.missing) || atomic_load(&s.duplicates) ||
+		atomic_load(&s.out_of_range) || atomic_load(&s.slow_syncs);
+	printf("%s\n", failed ? "failed" : "passed");
+	return failed;
+}
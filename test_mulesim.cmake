@@ -0,0 +1,37 @@
+# replay the t21 recording through mulesim without and with a 1ms wake
+# cost. workers are parked at the start of each of its two epochs, so each
+# policy must take at least 2ms longer with the wake cost.
+
+execute_process(COMMAND ${TEST_MUMULE} -r ${RECORDING} RESULT_VARIABLE rc)
+if (NOT rc EQUAL 0)
+  message(FATAL_ERROR "test_mumule -r failed: ${rc}")
+endif()
+
+foreach(wake 0 1000000)
+  execute_process(COMMAND ${MULESIM} -t 2 -g 4 -w ${wake} ${RECORDING}
+    RESULT_VARIABLE rc OUTPUT_VARIABLE out)
+  if (NOT rc EQUAL 0)
+    message(FATAL_ERROR "mulesim -w ${wake} failed: ${rc}")
+  endif()
+  # makespan in microseconds per policy
+  string(REGEX MATCHALL "\n[a-z]+ +2 +[0-9]+ +[0-9]+\\.[0-9]+" rows "${out}")
+  list(LENGTH rows n)
+  if (NOT n EQUAL 4)
+    message(FATAL_ERROR "unexpected mulesim output:\n${out}")
+  endif()
+  set(us_${wake})
+  foreach(row ${rows})
+    string(REGEX REPLACE ".* ([0-9]+)\\.([0-9]+)$" "\\1\\2" us "${row}")
+    list(APPEND us_${wake} ${us})
+  endforeach()
+endforeach()
+
+foreach(i 0 1 2 3)
+  list(GET us_0 ${i} a)
+  list(GET us_1000000 ${i} b)
+  math(EXPR d "${b} - ${a}")
+  if (d LESS 2000)
+    message(FATAL_ERROR "wake cost not charged: ${a}us without, ${b}us with")
+  endif()
+endforeach()
+file(REMOVE ${RECORDING})
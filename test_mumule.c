@@ -3,6 +3,9 @@
 #include <assert.h>
 #include <stdatomic.h>
 #include "mumule.h"
+#include "mualgo.h"
+#include "mukernel.h"
+#include <sys/prctl.h>
 
 int debug = 0;
 _Atomic(size_t) counter = 0;
@@ -25,15 +28,735 @@ void t1()
 	assert(atomic_load(&counter) == 8);
 }
 
+_Atomic(size_t) arena_count[2];
+_Atomic(size_t) arena_inflight[2];
+_Atomic(size_t) arena_peak[2];
+
+void w2(void *arg, size_t thr_idx, size_t item_idx)
+{
+	size_t i = (size_t)arg;
+	size_t n = atomic_fetch_add(&arena_inflight[i], 1) + 1;
+	size_t peak = atomic_load(&arena_peak[i]);
+	while (n > peak && !atomic_compare_exchange_weak(&arena_peak[i], &peak, n));
+	atomic_fetch_add_explicit(&arena_count[i], 1, __ATOMIC_SEQ_CST);
+	atomic_fetch_sub(&arena_inflight[i], 1);
+}
+
+void t2()
+{
+	mu_mule host, a0, a1;
+	mule_init(&host, 2, w1, NULL);
+	mule_init(&a0, 0, w2, (void*)0);
+	mule_init(&a1, 0, w2, (void*)1);
+	assert(!mule_attach(&a0, &host, 1));
+	assert(!mule_attach(&a1, &host, 0));
+	mule_submit(&a0, 64);
+	mule_submit(&a1, 64);
+	mule_start(&host);
+	mule_sync(&a0);
+	mule_sync(&a1);
+	mule_destroy(&a0);
+	mule_destroy(&a1);
+	mule_stop(&host);
+	mule_destroy(&host);
+	assert(atomic_load(&arena_count[0]) == 64);
+	assert(atomic_load(&arena_count[1]) == 64);
+	assert(atomic_load(&arena_peak[0]) == 1);
+}
+
+void t3()
+{
+	mu_mule c0, c1;
+	atomic_store(&arena_count[0], 0);
+	atomic_store(&arena_count[1], 0);
+	mule_init(&c0, 0, w2, (void*)0);
+	mule_init(&c1, 0, w2, (void*)1);
+	assert(!mule_shared_attach(&c0, 0));
+	assert(!mule_shared_attach(&c1, 0));
+	assert(!atomic_load(&mule_shared.mule.running));
+	mule_submit(&c0, 16);
+	mule_submit(&c1, 16);
+	assert(atomic_load(&mule_shared.mule.running));
+	mule_sync(&c0);
+	mule_sync(&c1);
+	assert(!mule_shared_detach(&c0));
+	assert(atomic_load(&mule_shared.mule.running));
+	assert(!mule_shared_detach(&c1));
+	assert(!atomic_load(&mule_shared.mule.running));
+	mule_destroy(&c0);
+	mule_destroy(&c1);
+	assert(atomic_load(&arena_count[0]) == 16);
+	assert(atomic_load(&arena_count[1]) == 16);
+
+	/* destroying an attached arena releases its shared pool reference */
+	mule_init(&c0, 0, w2, (void*)0);
+	assert(!mule_shared_attach(&c0, 0));
+	mule_submit(&c0, 16);
+	mule_sync(&c0);
+	assert(atomic_load(&mule_shared.mule.running));
+	mule_destroy(&c0);
+	assert(mule_shared.refcount == 0);
+	assert(!atomic_load(&mule_shared.mule.running));
+}
+
+void w4(void *arg, size_t thr_idx, size_t item_idx)
+{
+	mu_mule *mule = (mu_mule*)arg;
+	char *buf = (char*)mule_scratch_alloc(mule, thr_idx, 1000, 64);
+	assert(buf && ((uintptr_t)buf & 63) == 0);
+	memset(buf, (int)item_idx, 1000);
+}
+
+size_t scratch_blocks(mu_mule *mule)
+{
+	size_t n = 0;
+	for (size_t i = 0; i < mule->num_threads; i++) {
+		for (mu_scratch_block *b = mule->threads[i].scratch.head; b; b = b->next) n++;
+	}
+	return n;
+}
+
+void t4()
+{
+	mu_mule mule;
+	size_t n;
+	mule_init(&mule, 1, w4, &mule);
+	mule_start(&mule);
+	mule_submit(&mule, 4096);
+	mule_sync(&mule);
+	n = scratch_blocks(&mule);
+	assert(n > 1);
+	mule_reset(&mule);
+	mule_submit(&mule, 4096);
+	mule_sync(&mule);
+	assert(scratch_blocks(&mule) == n);
+	mule_stop(&mule);
+	mule_destroy(&mule);
+
+	/* huge page blocks start on a huge page boundary */
+	mule_init(&mule, 1, w4, &mule);
+	mule_scratch_config(&mule, 0, mumule_scratch_hugepages);
+	mule_start(&mule);
+	mule_submit(&mule, 4096);
+	mule_sync(&mule);
+	for (mu_scratch_block *b = mule.threads[0].scratch.head; b; b = b->next) {
+		assert(((uintptr_t)b & (mumule_scratch_huge_page_size - 1)) == 0);
+	}
+	mule_stop(&mule);
+	mule_destroy(&mule);
+}
+
+void w5(void *arg, size_t thr_idx, size_t item_idx)
+{
+	char name[16], expect[16];
+	char probe[16384];
+	memset(probe, 0, sizeof(probe));
+	prctl(PR_GET_NAME, name, 0, 0, 0);
+	snprintf(expect, sizeof(expect), "mtest-%zu", thr_idx);
+	assert(strcmp(name, expect) == 0);
+	assert(sched_getscheduler(0) == SCHED_BATCH);
+	atomic_fetch_add_explicit(&counter, probe[item_idx], __ATOMIC_SEQ_CST);
+}
+
+void t5()
+{
+	mu_mule mule;
+	mu_thread_attr attr = { 128 << 10, mumule_stack_prefault | mumule_stack_hugepages,
+		mumule_sched_batch, "mtest" };
+	size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+	mule_init(&mule, 2, w5, NULL);
+	mule_thread_attr(&mule, &attr);
+	mule_submit(&mule, 8);
+	mule_start(&mule);
+	mule_sync(&mule);
+	assert(mule.threads[0].stack && mule.threads[1].stack);
+	for (size_t i = 0; i < 2; i++) {
+		uintptr_t base = (uintptr_t)mule.threads[i].stack + page_size;
+		assert((base & (mumule_scratch_huge_page_size - 1)) == 0);
+	}
+	mule_stop(&mule);
+	assert(!mule.threads[0].stack && !mule.threads[1].stack);
+	mule_destroy(&mule);
+}
+
+void sum_u64(void *arg, void *acc, size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; i++) *(size_t*)acc += i;
+}
+
+void add_u64(void *arg, void *acc, const void *rhs)
+{
+	*(size_t*)acc += *(const size_t*)rhs;
+}
+
+void sum_f64(void *arg, void *acc, size_t idx)
+{
+	*(double*)acc += 1.0 / (double)(idx + 1);
+}
+
+void add_f64(void *arg, void *acc, const void *rhs)
+{
+	*(double*)acc += *(const double*)rhs;
+}
+
+double harmonic(size_t nthreads, size_t n)
+{
+	mu_mule mule;
+	double zero = 0, sum;
+	mu_reduce_op op = { sizeof(double), &zero, n, 0, NULL, sum_f64, add_f64,
+		NULL, mumule_reduce_deterministic };
+	mule_init(&mule, nthreads, NULL, NULL);
+	mule_start(&mule);
+	assert(!mule_reduce(&mule, &op, &sum));
+	mule_destroy(&mule);
+	return sum;
+}
+
+void t6()
+{
+	mu_mule mule;
+	size_t zero = 0, sum = 0, n = 100000;
+	mu_reduce_op op = { sizeof(size_t), &zero, n, 0, sum_u64, NULL, add_u64,
+		NULL, 0 };
+	mule_init(&mule, 2, NULL, NULL);
+	mule_start(&mule);
+	assert(!mule_reduce(&mule, &op, &sum));
+	assert(sum == n * (n - 1) / 2);
+	mule_destroy(&mule);
+
+	double h1 = harmonic(1, 1000000), h2 = harmonic(2, 1000000);
+	assert(memcmp(&h1, &h2, sizeof(double)) == 0);
+}
+
+void t7()
+{
+	mu_mule mule;
+	size_t sizes[] = { 1, 7, 100003, 1000000 };
+	mule_init(&mule, 2, NULL, NULL);
+	mule_start(&mule);
+	for (size_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++) {
+		size_t n = sizes[s];
+		uint32_t *in32 = malloc(n * sizeof(uint32_t)), *out32 = malloc(n * sizeof(uint32_t));
+		uint64_t *in64 = malloc(n * sizeof(uint64_t)), *out64 = malloc(n * sizeof(uint64_t));
+		for (size_t i = 0; i < n; i++) in64[i] = in32[i] = (uint32_t)(i * 2654435761u) >> 20;
+		assert(!mule_scan_u32(&mule, out32, in32, n, mumule_scan_exclusive));
+		assert(!mule_scan_u64(&mule, out64, in64, n, mumule_scan_inclusive));
+		uint32_t sum32 = 0;
+		uint64_t sum64 = 0;
+		for (size_t i = 0; i < n; i++) {
+			assert(out32[i] == sum32);
+			sum32 += in32[i];
+			sum64 += in64[i];
+			assert(out64[i] == sum64);
+		}
+		assert(!mule_scan_u64(&mule, in64, in64, n, mumule_scan_inclusive));
+		assert(memcmp(in64, out64, n * sizeof(uint64_t)) == 0);
+		free(in32); free(out32); free(in64); free(out64);
+	}
+	mule_destroy(&mule);
+}
+
+int cmp_f64(const void *a, const void *b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+void t8()
+{
+	mu_mule mule;
+	size_t n = 300000;
+	uint32_t *k32 = malloc(n * sizeof(uint32_t)), *o32 = malloc(n * sizeof(uint32_t));
+	uint64_t *k64 = malloc(n * sizeof(uint64_t)), *v = malloc(n * sizeof(uint64_t));
+	double *f = malloc(n * sizeof(double)), *g = malloc(n * sizeof(double));
+	double *d = malloc(n * sizeof(double)), *e = malloc(n * sizeof(double));
+	uint64_t x = 88172645463325252ull;
+	for (size_t i = 0; i < n; i++) {
+		x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+		o32[i] = k32[i] = (uint32_t)x & 0xfff0ffff;
+		k64[i] = x;
+		g[i] = f[i] = (double)(x >> 11) / 1e6;
+		/* mostly one key, so duplicates must spread over buckets */
+		e[i] = d[i] = (x & 7) ? 1.0 : (double)(x >> 61);
+		v[i] = i;
+	}
+	mule_init(&mule, 2, NULL, NULL);
+	mule_start(&mule);
+	assert(!mule_sort_u32(&mule, k32, v, n));
+	assert(!mule_sort_u64(&mule, k64, NULL, n));
+	assert(!mule_sort(&mule, f, n, sizeof(double), cmp_f64));
+	assert(!mule_sort(&mule, d, n, sizeof(double), cmp_f64));
+	mule_destroy(&mule);
+	qsort(g, n, sizeof(double), cmp_f64);
+	qsort(e, n, sizeof(double), cmp_f64);
+	for (size_t i = 0; i < n; i++) {
+		assert(o32[v[i]] == k32[i]);
+		if (i) {
+			assert(k32[i-1] < k32[i] || (k32[i-1] == k32[i] && v[i-1] < v[i]));
+			assert(k64[i-1] <= k64[i]);
+		}
+	}
+	assert(memcmp(f, g, n * sizeof(double)) == 0);
+	assert(memcmp(d, e, n * sizeof(double)) == 0);
+	free(k32); free(o32); free(k64); free(v); free(f); free(g); free(d); free(e);
+}
+
+int is_odd(void *arg, size_t thr_idx, size_t idx)
+{
+	return ((const uint32_t*)arg)[idx] & 1;
+}
+
+void t9()
+{
+	mu_mule mule;
+	size_t n = 100001, kept;
+	uint32_t *in = malloc(n * sizeof(uint32_t)), *out = malloc(n * sizeof(uint32_t));
+	size_t *idx = malloc(n * sizeof(size_t));
+	for (size_t i = 0; i < n; i++) in[i] = (uint32_t)(i * 2654435761u) >> 7;
+	mule_init(&mule, 2, NULL, NULL);
+	mule_start(&mule);
+	kept = mule_compact(&mule, out, in, n, sizeof(uint32_t), is_odd, in);
+	assert(mule_compact_idx(&mule, idx, n, is_odd, in) == kept);
+	for (size_t i = 0, j = 0; i < n; i++) {
+		if (in[i] & 1) { assert(out[j] == in[i] && idx[j] == i); j++; }
+	}
+	assert(mule_partition(&mule, out, in, n, sizeof(uint32_t), is_odd, in) == kept);
+	for (size_t i = 0, j = 0, k = kept; i < n; i++) {
+		assert(out[(in[i] & 1) ? j++ : k++] == in[i]);
+	}
+	mule_destroy(&mule);
+	free(in); free(out); free(idx);
+}
+
+void t10()
+{
+	mu_mule mule;
+	size_t n = (16 << 20) + 12345;
+	char *a = malloc(n + 1), *b = malloc(n + 1), *c = malloc(n);
+	for (size_t i = 0; i < n; i++) c[i] = (char)(i * 31);
+	mule_init(&mule, 2, NULL, NULL);
+	mule_start(&mule);
+	mule_memset(&mule, a + 1, 0x5a, n, 0);
+	for (size_t i = 0; i < n; i++) assert(a[i + 1] == 0x5a);
+	mule_memcpy(&mule, b + 1, c, n, mumule_mem_temporal);
+	assert(memcmp(b + 1, c, n) == 0);
+	mule_memcpy(&mule, a + 1, c, n, mumule_mem_nontemporal);
+	assert(memcmp(a + 1, c, n) == 0);
+	mule_first_touch(&mule, b, n);
+	for (size_t i = 0; i < n; i++) assert(b[i] == 0);
+	mule_destroy(&mule);
+	free(a); free(b); free(c);
+}
+
+void t11()
+{
+	mu_mule mule;
+	size_t n = 1000003;
+	float *x = malloc(n * sizeof(float)), *y = malloc(n * sizeof(float));
+	uint8_t *d = malloc(n);
+	uint64_t hist[256], total = 0;
+	float mn, mx;
+	for (size_t i = 0; i < n; i++) {
+		x[i] = (float)(i % 1000) - 500.0f;
+		y[i] = 1.0f;
+		d[i] = (uint8_t)(i * 7 % 251);
+	}
+	d[n - 3] = 0xff;
+	mule_init(&mule, 2, NULL, NULL);
+	mule_start(&mule);
+	mule_axpy_f32(&mule, 2.0f, x, y, n);
+	for (size_t i = 0; i < n; i++) assert(y[i] == 2.0f * x[i] + 1.0f);
+	float dot = mule_dot_f32(&mule, y, y, n);
+	double ref = 0;
+	for (size_t i = 0; i < n; i++) ref += (double)y[i] * y[i];
+	assert((dot > ref ? dot - ref : ref - dot) / ref < 1e-5);
+	mule_minmax_f32(&mule, x, n, &mn, &mx);
+	assert(mn == -500.0f && mx == 499.0f);
+	mule_histogram_u8(&mule, d, n, hist);
+	for (size_t k = 0; k < 256; k++) total += hist[k];
+	assert(total == n && hist[0xff] == 1);
+	assert(mule_count_byte(&mule, d, n, 0xff) == 1);
+	assert(mule_find_byte(&mule, d, n, 0xff) == n - 3);
+	assert(mule_find_byte(&mule, d, n, 0xfe) == n);
+	assert(mule_adler32(&mule, 1, (const uint8_t*)"Wikipedia", 9) == 0x11e60398);
+	assert(mule_adler32(&mule, 1, d, n) == mule_range_adler32(1, d, n));
+	mule_destroy(&mule);
+	free(x); free(y); free(d);
+
+	/* float reductions give the same bits for any pool size */
+	size_t big = (size_t)4 * mumule_chunks_per_thread * mumule_kernel_min_grain * 4;
+	float dots[2];
+	uint64_t r = 88172645463325252ull;
+	assert((x = malloc(big * sizeof(float))));
+	for (size_t i = 0; i < big; i++) {
+		r ^= r << 13; r ^= r >> 7; r ^= r << 17;
+		x[i] = (float)(int32_t)(r >> 32) / 2147483648.0f;
+	}
+	for (size_t k = 0; k < 2; k++) {
+		mule_init(&mule, k ? 4 : 1, NULL, NULL);
+		mule_start(&mule);
+		dots[k] = mule_dot_f32(&mule, x, x, big);
+		mule_destroy(&mule);
+	}
+	assert(memcmp(&dots[0], &dots[1], sizeof(float)) == 0);
+	free(x);
+}
+
+void t12()
+{
+	mu_mule mule;
+	mu_stats stats;
+	mu_worker_stats workers[2];
+	mule_init(&mule, 2, w1, NULL);
+	mule_stats_config(&mule, mumule_stats_time);
+	mule_start(&mule);
+	mule_submit(&mule, 100);
+	mule_sync(&mule);
+	mule_submit(&mule, 28);
+	mule_sync(&mule);
+	mule_stats(&mule, &stats, workers);
+	assert(stats.num_threads == 2);
+	assert(stats.syncs == 2);
+	assert(stats.total.items == 128);
+	assert(workers[0].items + workers[1].items == 128);
+	assert(stats.total.parks == stats.total.wake_signals + stats.total.wake_timeouts);
+	mule_stop(&mule);
+	mule_destroy(&mule);
+}
+
+void w13(void *arg, size_t thr_idx, size_t item_idx)
+{
+	if (item_idx == 7) {
+		struct timespec ts = { 0, 2000000 };
+		nanosleep(&ts, NULL);
+	}
+}
+
+void t13()
+{
+	mu_mule mule;
+	mu_histogram hist;
+	mu_slow_item slow[4];
+	mule_init(&mule, 2, w13, NULL);
+	mule_stats_config(&mule, mumule_stats_histogram);
+	mule_start(&mule);
+	mule_submit(&mule, 64);
+	mule_sync(&mule);
+	mule_histogram(&mule, mumule_hist_kernel, &hist);
+	assert(hist.count == 64);
+	assert(hist.max_ns >= 1000000);
+	assert(mule_histogram_percentile(&hist, 50) < 1000000);
+	assert(mule_histogram_percentile(&hist, 100) == hist.max_ns);
+	assert(mule_slowest(&mule, slow, 4) == 4);
+	assert(slow[0].item_idx == 7 && slow[0].ns >= slow[1].ns);
+	mule_histogram(&mule, mumule_hist_delay, &hist);
+	assert(hist.count == 64);
+	mule_stop(&mule);
+	mule_destroy(&mule);
+	for (uint64_t v = 1; v; v = v * 3 + 1) {
+		assert(_mule_hist_bucket_value(_mule_hist_bucket(v)) >= v);
+		size_t b = _mule_hist_bucket(v);
+		assert(_mule_hist_bucket(_mule_hist_bucket_value(b)) == b);
+		if (v > UINT64_MAX / 4) break;
+	}
+}
+
+void t14()
+{
+	mu_mule mule;
+	char path[] = "/tmp/test_mumule_trace_XXXXXX", buf[1 << 16];
+	int fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+	mule_init(&mule, 2, w1, NULL);
+	assert(mule_trace_write(&mule, path) == -1);
+	assert(!mule_trace_config(&mule, 1000, 4));
+	assert(mule.threads[0].trace->mask == 1023);
+	mule_start(&mule);
+	mule_submit(&mule, 64);
+	mule_sync(&mule);
+	mule_stop(&mule);
+	assert(!mule_trace_write(&mule, path));
+	mule_destroy(&mule);
+	FILE *f = fopen(path, "r");
+	size_t len = fread(buf, 1, sizeof(buf) - 1, f);
+	buf[len] = 0;
+	fclose(f);
+	unlink(path);
+	assert(strncmp(buf, "{\"displayTimeUnit\"", 18) == 0);
+	assert(strstr(buf, "\"name\":\"mule-1\""));
+	assert(strstr(buf, "\"name\":\"item\",\"ph\":\"X\""));
+	assert(strstr(buf, "\"name\":\"submit\""));
+	assert(strstr(buf, "\"name\":\"sync\""));
+	assert(strcmp(buf + len - 3, "]}\n") == 0);
+}
+
+void t15()
+{
+	char path[] = "/tmp/test_mumule_log_XXXXXX", buf[128], magic[8];
+	uint64_t args[4];
+	double d = 2.5;
+	uint32_t nstrings, nrecs;
+	args[0] = (uint64_t)-3; args[1] = 42; args[2] = 0;
+	memcpy(&args[3], &d, sizeof(d));
+	mu_log_format(buf, sizeof(buf), "%d %5zu %s %.2f %%", args, 4, "str", 4);
+	assert(strcmp(buf, "-3    42 str 2.50 %") == 0);
+	mu_log_format(buf, 8, "%s", args + 2, 1, "truncated", 10);
+	assert(strcmp(buf, "truncat") == 0);
+	mu_log_format(buf, sizeof(buf), "%s", args + 1, 1, "str", 4);
+	assert(strcmp(buf, "(bad)") == 0);
+
+	int fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+	mu_log_flush();
+	mu_log_config(mu_log_mode_hold);
+	mu_logf("hold-%d-%s\n", 1, "a");
+	mu_logf("hold-%d-%s\n", 2, "b");
+	mu_logf("hold-%.1f\n", 3.0);
+	assert(!mu_log_dump(path));
+	mu_log_config(mu_log_mode_async);
+	FILE *f = fopen(path, "rb");
+	assert(fread(magic, 1, 8, f) == 8 && memcmp(magic, mu_log_dump_magic, 8) == 0);
+	assert(fread(&nstrings, 4, 1, f) == 1 && nstrings == 2);
+	assert(fread(&nrecs, 4, 1, f) == 1 && nrecs == 3);
+	fclose(f);
+	unlink(path);
+
+	/* the flusher sleeps once the rings are empty */
+	for (int i = 0; i < 1000 && !atomic_load(&mu_log_shared.idle); i++) usleep(1000);
+	assert(atomic_load(&mu_log_shared.idle));
+}
+
+void t16()
+{
+	int saved = debug;
+	debug = 0;
+	assert(!mu_log_enabled(mu_log_cat_worker, 1));
+	mu_set_log_level(mu_log_cat_worker, 2);
+	assert(mu_log_enabled(mu_log_cat_worker, 2) == (MULE_LOG_LEVEL >= 2));
+	assert(!mu_log_enabled(mu_log_cat_sync, 1));
+	mu_set_log_level(mu_log_cat_worker, 0);
+	mu_set_debug(1);
+	assert(mu_log_enabled(mu_log_cat_sync, 1) == (MULE_LOG_LEVEL >= 1));
+	assert(!mu_log_enabled(mu_log_cat_sync, 2));
+	debug = saved;
+}
+
+void t17()
+{
+	mu_mule mule;
+	char path[64];
+	snprintf(path, sizeof(path), "/tmp/test_mumule_stat_%d", (int)getpid());
+	mule_init(&mule, 2, w1, NULL);
+	assert(!mule_publish(&mule, path, 1000000));
+	assert(mule_publish(&mule, path, 1000000) == -1);
+	mule_start(&mule);
+	mule_submit(&mule, 64);
+	mule_sync(&mule);
+	int fd = open(path, O_RDONLY);
+	assert(fd >= 0);
+	size_t size = sizeof(mu_shm_page) + 2 * sizeof(mu_shm_worker);
+	mu_shm_page *page = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	assert(page != MAP_FAILED);
+	assert(memcmp(page->magic, mumule_shm_magic, 8) == 0 && page->num_threads == 2);
+	assert(!mule_unpublish(&mule));
+	assert(!(atomic_load(&page->seq) & 1));
+	assert(page->processed == 64);
+	assert(page->workers[0].items + page->workers[1].items == 64);
+	assert(access(path, F_OK) != 0);
+	munmap(page, size);
+	mule_destroy(&mule);
+}
+
+void w18(void *arg, size_t thr_idx, size_t item_idx)
+{
+	struct timespec ts = { 0, item_idx == 1 ? 20000000 : 100000 };
+	nanosleep(&ts, NULL);
+}
+
+void t18()
+{
+	mu_mule mule;
+	mu_epoch_report report;
+	mu_worker_epoch workers[2];
+	mule_init(&mule, 2, w18, NULL);
+	assert(mule_epoch_report(&mule, &report, workers) == -1);
+	mule_stats_config(&mule, mumule_stats_epoch);
+	assert(mule_epoch_report(&mule, &report, workers) == -1);
+	mule_start(&mule);
+	mule_submit(&mule, 16);
+	mule_sync(&mule);
+	assert(!mule_epoch_report(&mule, &report, workers));
+	assert(report.epoch == 1 && report.items == 16 && report.num_threads == 2);
+	assert(workers[0].items + workers[1].items == 16);
+	assert(report.wall_ns >= 20000000 && report.max_busy_ns >= 20000000);
+	assert(report.imbalance > 1.0 && report.imbalance <= 2.0);
+	assert(report.idle_wait_ns > 0 && report.idle_wait_ns <= report.wall_ns);
+	mule_submit(&mule, 4);
+	mule_submit(&mule, 4);
+	mule_sync(&mule);
+	assert(!mule_epoch_report(&mule, &report, NULL));
+	assert(report.epoch == 2 && report.items == 8);
+	mule_stop(&mule);
+	mule_destroy(&mule);
+}
+
+_Atomic(size_t) straggler_count;
+_Atomic(int) straggler_seen;
+
+void w19(void *arg, size_t thr_idx, size_t item_idx)
+{
+	struct timespec ts = { 0, item_idx == (size_t)arg ? 80000000 : 1000000 };
+	nanosleep(&ts, NULL);
+}
+
+/* late wakeups on a loaded machine may add reports, the straggler must be one */
+void s19(void *arg, const mu_straggler *s)
+{
+	assert(s->queue == (mu_mule*)arg && s->elapsed_ns > 0);
+	if (s->item_idx == (size_t)((mu_mule*)arg)->userdata) atomic_store(&straggler_seen, 1);
+	atomic_fetch_add(&straggler_count, 1);
+}
+
+void t19()
+{
+	mu_mule mule;
+	mule_init(&mule, 2, w19, (void*)5);
+	assert(mule_watchdog(&mule, 0, 0, s19, &mule) == -1);
+	assert(!mule_watchdog(&mule, 20000000, 0, s19, &mule));
+	assert(mule_watchdog(&mule, 20000000, 0, s19, &mule) == -1);
+	mule_start(&mule);
+	mule_submit(&mule, 16);
+	mule_sync(&mule);
+	assert(atomic_load(&straggler_count) >= 1 && atomic_load(&straggler_seen));
+	assert(!mule_watchdog_stop(&mule));
+
+	/* relative to the median, after enough samples */
+	atomic_store(&straggler_count, 0);
+	atomic_store(&straggler_seen, 0);
+	mule.userdata = (void*)(16 + 40);
+	assert(!mule_watchdog(&mule, 0, 10.0, s19, &mule));
+	mule_submit(&mule, 64);
+	mule_sync(&mule);
+	assert(atomic_load(&straggler_count) >= 1 && atomic_load(&straggler_seen));
+	mule_stop(&mule);
+	mule_destroy(&mule);
+}
+
+void w20(void *arg, size_t thr_idx, size_t item_idx)
+{
+	volatile uint64_t x = item_idx;
+	for (int i = 0; i < 100000; i++) x = x * 6364136223846793005ull + 1;
+}
+
+void t20()
+{
+	mu_mule mule;
+	mu_perf_counters total, workers[2];
+	mu_epoch_report report;
+	mule_init(&mule, 2, w20, NULL);
+	assert(mule_perf(&mule, &total, workers) == -1);
+	mule_stats_config(&mule, mumule_stats_perf | mumule_stats_epoch);
+	mule_start(&mule);
+	mule_submit(&mule, 32);
+	mule_sync(&mule);
+	assert(!mule_epoch_report(&mule, &report, NULL));
+	if (mule_perf(&mule, &total, workers) == 0) {
+		/* counters available: the kernel retires millions of instructions */
+		assert(report.perf_valid && report.perf.instructions > 1000000);
+		assert(total.instructions >= report.perf.instructions);
+		mule_stop(&mule);
+		mu_perf_counters after;
+		assert(!mule_perf(&mule, &after, NULL));
+		assert(after.instructions >= total.instructions);
+	} else {
+		/* counters refused, everything reads as zero */
+		assert(!report.perf_valid && report.perf.cycles == 0);
+		assert(total.cycles == 0 && workers[1].instructions == 0);
+	}
+	mule_destroy(&mule);
+}
+
+/* `-r path` keeps a copy of the t21 recording for the mulesim test */
+static const char *record_path;
+
+void t21()
+{
+	mu_mule mule;
+	char path[] = "/tmp/test_mumule_record_XXXXXX", line[64];
+	unsigned long long t, n;
+	int fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+	mule_init(&mule, 2, w20, NULL);
+	assert(mule_record_write(&mule, path) == -1);
+	mule_start(&mule);
+	mule_submit(&mule, 4);
+	mule_sync(&mule);
+	assert(!mule_record_config(&mule, 40));
+	mule_submit(&mule, 16);
+	mule_sync(&mule);
+	mule_submit(&mule, 32);
+	mule_sync(&mule);
+	assert(!mule_record_write(&mule, path));
+	if (record_path) assert(!mule_record_write(&mule, record_path));
+	mule_stop(&mule);
+	mule_destroy(&mule);
+
+	FILE *f = fopen(path, "r");
+	assert(f);
+	assert(fgets(line, sizeof(line), f) && !strcmp(line, "mumule-record 1\n"));
+	assert(fgets(line, sizeof(line), f) && !strcmp(line, "threads 2\n"));
+	assert(fgets(line, sizeof(line), f) && sscanf(line, "submit %llu %llu", &t, &n) == 2);
+	assert(t == 0 && n == 16);
+	assert(fgets(line, sizeof(line), f) && sscanf(line, "sync %llu", &t) == 1);
+	assert(fgets(line, sizeof(line), f) && sscanf(line, "submit %llu %llu", &t, &n) == 2);
+	assert(n == 32);
+	assert(fgets(line, sizeof(line), f) && sscanf(line, "sync %llu", &t) == 1);
+	assert(fgets(line, sizeof(line), f) && sscanf(line, "items %llu", &n) == 1 && n == 40);
+	for (int i = 0; i < 40; i++) {
+		assert(fgets(line, sizeof(line), f) && strtoull(line, NULL, 10) > 0);
+	}
+	assert(!fgets(line, sizeof(line), f));
+	fclose(f);
+	remove(path);
+}
+
 int main(int argc, const char **argv)
 {
-    if (argc == 2 && strcmp(argv[1], "-v") == 0) {
-        mu_set_debug(1);
-    } else if (argc == 2 && strcmp(argv[1], "-vv") == 0) {
-        mu_set_debug(2);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-v") == 0) {
+            mu_set_debug(1);
+        } else if (strcmp(argv[i], "-vv") == 0) {
+            mu_set_debug(2);
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        }
     }
 
 	t1();
+	t2();
+	t3();
+	t4();
+	t5();
+	t6();
+	t7();
+	t8();
+	t9();
+	t10();
+	t11();
+	t12();
+	t13();
+	t14();
+	t15();
+	t16();
+	t17();
+	t18();
+	t19();
+	t20();
+	t21();
 
 	debugf("test-complete");
 }